@@ -0,0 +1,209 @@
+// SPDX-License-Identifier: GPL-2.0+
+
+/*
+ * Accelerometer driver for the BuilderBot
+ *
+ * The sensor-actuator AVR samples the accelerometer at a fixed rate and
+ * queues the samples in a FIFO. Each trigger drains the FIFO, reading up
+ * to BB_AVR_ACCEL_SAMPLES_PER_FRAME samples per round trip, and pushes
+ * every sample with a timestamp reconstructed from the sampling rate.
+ */
+
+
+#include <linux/kernel.h>
+#include <linux/mfd/bb-avr.h>
+#include <linux/module.h>
+#include <linux/of_device.h>
+#include <linux/platform_device.h>
+#include <linux/slab.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/sysfs.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
+
+#define BB_AVR_ACCEL_AXES 3
+#define BB_AVR_ACCEL_SAMPLE_SIZE (BB_AVR_ACCEL_AXES * sizeof(__be16))
+/* the reply starts with the number of valid samples */
+#define BB_AVR_ACCEL_SAMPLES_PER_FRAME \
+	((BB_AVR_DATA_SIZE_MAX - 1) / BB_AVR_ACCEL_SAMPLE_SIZE)
+#define BB_AVR_ACCEL_RESP_LEN \
+	(1 + BB_AVR_ACCEL_SAMPLES_PER_FRAME * BB_AVR_ACCEL_SAMPLE_SIZE)
+/* upper bound on the frames read per trigger */
+#define BB_AVR_ACCEL_MAX_FRAMES 8
+#define BB_AVR_ACCEL_DEFAULT_SAMPLING_FREQUENCY 100
+
+static const struct of_device_id bb_avr_accel_of_match[] = {
+	{ .compatible = "ulb,bb-avr-accel" },
+	{ /* sentinel */ }
+};
+
+/**
+ * struct bb_avr_accel - Accelerometer on the sensor-actuator AVR
+ *
+ * @avr: Pointer to parent BuilderBot AVR device
+ * @sampling_frequency: Rate at which the AVR fills its FIFO in Hz
+ */
+struct bb_avr_accel {
+	struct bb_avr *avr;
+	u32 sampling_frequency;
+};
+
+static int bb_avr_accel_read_raw(struct iio_dev *indio_dev,
+				 struct iio_chan_spec const *chan,
+				 int *val, int *val2, long mask)
+{
+	struct bb_avr_accel *accel = iio_priv(indio_dev);
+
+	switch (mask) {
+	case IIO_CHAN_INFO_SAMP_FREQ:
+		*val = accel->sampling_frequency;
+		return IIO_VAL_INT;
+	default:
+		return -EINVAL;
+	}
+}
+
+static const struct iio_info bb_avr_accel_info = {
+	.read_raw = bb_avr_accel_read_raw,
+};
+
+#define BB_AVR_ACCEL_CHANNEL(axis, index) {				\
+	.type = IIO_ACCEL,						\
+	.modified = true,						\
+	.channel2 = IIO_MOD_##axis,					\
+	.info_mask_shared_by_all = BIT(IIO_CHAN_INFO_SAMP_FREQ),	\
+	.scan_index = index,						\
+	.scan_type = {							\
+		.sign = 's',						\
+		.realbits = 16,						\
+		.storagebits = 16,					\
+		.endianness = IIO_BE,					\
+	},								\
+}
+
+static const struct iio_chan_spec bb_avr_accel_channels[] = {
+	BB_AVR_ACCEL_CHANNEL(X, 0),
+	BB_AVR_ACCEL_CHANNEL(Y, 1),
+	BB_AVR_ACCEL_CHANNEL(Z, 2),
+	IIO_CHAN_SOFT_TIMESTAMP(3),
+};
+
+static const unsigned long bb_avr_accel_scan_masks[] = {0x7, 0};
+
+static irqreturn_t bb_avr_accel_trigger_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio_dev = pf->indio_dev;
+	struct bb_avr_accel *accel = iio_priv(indio_dev);
+	s64 period = div_u64(NSEC_PER_SEC, accel->sampling_frequency);
+	u8 tx_data = BB_AVR_ACCEL_SAMPLES_PER_FRAME;
+	u8 rx_data[BB_AVR_ACCEL_MAX_FRAMES][BB_AVR_ACCEL_RESP_LEN];
+	/* three axes plus an aligned timestamp */
+	__be16 scan[8] __aligned(8);
+	unsigned int frames, frame, sample, count, total = 0;
+	int ret;
+
+	/* drain the FIFO, a full frame means more samples may be waiting */
+	for (frames = 0; frames < BB_AVR_ACCEL_MAX_FRAMES; frames++) {
+		ret = bb_avr_exec(accel->avr, BB_AVR_CMD_GET_ACCEL_READING,
+				  &tx_data, 1, rx_data[frames],
+				  BB_AVR_ACCEL_RESP_LEN);
+		if (ret < 0)
+			break;
+		count = min_t(u8, rx_data[frames][0],
+			      BB_AVR_ACCEL_SAMPLES_PER_FRAME);
+		rx_data[frames][0] = count;
+		total += count;
+		if (count < BB_AVR_ACCEL_SAMPLES_PER_FRAME) {
+			frames++;
+			break;
+		}
+	}
+
+	/*
+	 * The samples are sent oldest first and the newest sample is
+	 * assumed to have been taken when the trigger fired
+	 */
+	for (frame = 0; frame < frames; frame++) {
+		for (sample = 0; sample < rx_data[frame][0]; sample++) {
+			memcpy(scan, rx_data[frame] + 1 +
+			       sample * BB_AVR_ACCEL_SAMPLE_SIZE,
+			       BB_AVR_ACCEL_SAMPLE_SIZE);
+			total--;
+			iio_push_to_buffers_with_timestamp(indio_dev, scan,
+				pf->timestamp - total * period);
+		}
+	}
+
+	iio_trigger_notify_done(indio_dev->trig);
+	return IRQ_HANDLED;
+}
+
+static int bb_avr_accel_probe(struct platform_device *pdev)
+{
+	struct device *dev = &pdev->dev;
+	struct iio_dev *indio_dev;
+	struct bb_avr_accel *accel;
+	int ret = 0;
+
+	indio_dev = devm_iio_device_alloc(dev, sizeof(*accel));
+	if (!indio_dev)
+		return -ENOMEM;
+	accel = iio_priv(indio_dev);
+	/* set the parent AVR device */
+	accel->avr = dev_get_drvdata(dev->parent);
+	/* read the rate at which the AVR samples the accelerometer */
+	accel->sampling_frequency = BB_AVR_ACCEL_DEFAULT_SAMPLING_FREQUENCY;
+	of_property_read_u32(dev->of_node, "sampling-frequency",
+			     &accel->sampling_frequency);
+	if (accel->sampling_frequency == 0) {
+		dev_err(dev, "invalid sampling-frequency\n");
+		return -EINVAL;
+	}
+	/* set up the indio_dev struct */
+	dev_set_drvdata(dev, indio_dev);
+	indio_dev->name = "accel-sens";
+	indio_dev->dev.parent = dev;
+	indio_dev->info = &bb_avr_accel_info;
+	indio_dev->direction = IIO_DEVICE_DIRECTION_IN;
+	indio_dev->modes = INDIO_BUFFER_SOFTWARE;
+	indio_dev->channels = bb_avr_accel_channels;
+	indio_dev->num_channels = ARRAY_SIZE(bb_avr_accel_channels);
+	indio_dev->available_scan_masks = bb_avr_accel_scan_masks;
+
+	ret = iio_triggered_buffer_setup(indio_dev,
+					 iio_pollfunc_store_time,
+					 bb_avr_accel_trigger_handler,
+					 NULL);
+	if(ret < 0)
+		goto err_out;
+	ret = iio_device_register(indio_dev);
+err_out:
+	return ret;
+}
+
+static int bb_avr_accel_remove(struct platform_device *pdev)
+{
+	struct iio_dev *indio_dev = platform_get_drvdata(pdev);
+
+	iio_triggered_buffer_cleanup(indio_dev);
+	iio_device_unregister(indio_dev);
+
+	return 0;
+}
+
+static struct platform_driver bb_avr_accel_driver = {
+	.probe = bb_avr_accel_probe,
+	.remove = bb_avr_accel_remove,
+	.driver = {
+		.name = "bb-avr-accel",
+		.of_match_table = bb_avr_accel_of_match,
+	},
+};
+
+module_platform_driver(bb_avr_accel_driver);
+
+MODULE_DEVICE_TABLE(of, bb_avr_accel_of_match);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("BuilderBot AVR Accelerometer");
@@ -4,10 +4,15 @@
  * Differential drive system sensor driver for the BuilderBot
  *
  * Copyright (C) 2018 Michael Allwright
+ *
+ * When the wheel radius, track width and speed scale are given in the
+ * device tree, the wheel speeds are integrated at the trigger rate into
+ * a pose (x, y, heading) that is relative to where the buffer was enabled.
  */
 
 
 #include <linux/delay.h>
+#include <linux/fixp-arith.h>
 #include <linux/irq.h>
 #include <linux/kernel.h>
 #include <linux/mfd/bb-avr.h>
@@ -28,59 +33,210 @@ static const struct of_device_id bb_avr_dds_of_match[] = {
 	{ /* sentinel */ }
 };
 
+/* heading is kept in microradians in the range [0, 2 pi) */
+#define BB_AVR_DDS_TWO_PI_URAD 6283185
+/* fixp-arith allows at most 2^18 steps per turn */
+#define BB_AVR_DDS_FIXP_TWO_PI (1 << 18)
+
 /**
- * struct bb_avr_dds - Differential drive system actuator
+ * struct bb_avr_dds_odometry - Differential drive odometry
+ *
+ * @wheel_radius: Wheel radius in micrometers
+ * @track_width: Distance between the wheels in micrometers
+ * @speed_scale: Angular velocity of one LSB in microradians per second
+ * @timestamp: Time of the previous sample, zero before the first one
+ * @x: Position along the x axis in micrometers
+ * @y: Position along the y axis in micrometers
+ * @heading: Heading in microradians
+ */
+struct bb_avr_dds_odometry {
+	u32 wheel_radius;
+	u32 track_width;
+	u32 speed_scale;
+	s64 timestamp;
+	s64 x;
+	s64 y;
+	s32 heading;
+};
+
+/**
+ * struct bb_avr_dds - Differential drive system sensor
  *
  * @avr: Pointer to parent BuilderBot AVR device
+ * @odometry_enabled: Whether the odometry channels are present
+ * @odometry: State of the odometry integration
  */
 struct bb_avr_dds {
 	struct bb_avr *avr;
+	bool odometry_enabled;
+	struct bb_avr_dds_odometry odometry;
 };
 
+static int bb_avr_dds_read_raw(struct iio_dev *indio_dev,
+			       struct iio_chan_spec const *chan,
+			       int *val, int *val2, long mask)
+{
+	switch (mask) {
+	case IIO_CHAN_INFO_SCALE:
+		/* micrometers to meters, microradians to radians */
+		*val = 0;
+		*val2 = 1;
+		return IIO_VAL_INT_PLUS_MICRO;
+	default:
+		return -EINVAL;
+	}
+}
+
 static const struct iio_info bb_avr_dds_info = {};
 
+static const struct iio_info bb_avr_dds_odometry_info = {
+	.read_raw = bb_avr_dds_read_raw,
+};
+
+#define BB_AVR_DDS_SPEED_CHANNEL(index) {				\
+	.type = IIO_ANGL_VEL,						\
+	.indexed = true,						\
+	.channel = index,						\
+	.scan_index = index,						\
+	.scan_type = {							\
+		.sign = 's',						\
+		.realbits = 16,						\
+		.storagebits = 16,					\
+		.endianness = IIO_BE,					\
+	},								\
+}
+
 static const struct iio_chan_spec bb_avr_dds_channels[] = {
-	{
-		.type = IIO_ANGL_VEL,
-		.indexed = true,
-		.channel = 0,
-		.scan_index = 0,
-		.scan_type = {
-			.sign = 's',
-			.realbits = 16,
-			.storagebits = 16,
-			.endianness = IIO_BE,
-		},
-	}, {
-		.type = IIO_ANGL_VEL,
-		.indexed = true,
-		.channel = 1,
-		.scan_index = 1,
-		.scan_type = {
-			.sign = 's',
-			.realbits = 16,
-			.storagebits = 16,
-			.endianness = IIO_BE,
-		},
-	},
+	BB_AVR_DDS_SPEED_CHANNEL(0),
+	BB_AVR_DDS_SPEED_CHANNEL(1),
 	IIO_CHAN_SOFT_TIMESTAMP(2),
 };
 
+#define BB_AVR_DDS_POSE_CHANNEL(chan_type, chan_modifier, index) {	\
+	.type = chan_type,						\
+	.modified = (chan_modifier != IIO_NO_MOD),			\
+	.channel2 = chan_modifier,					\
+	.info_mask_separate = BIT(IIO_CHAN_INFO_SCALE),			\
+	.scan_index = index,						\
+	.scan_type = {							\
+		.sign = 's',						\
+		.realbits = 32,						\
+		.storagebits = 32,					\
+		.endianness = IIO_CPU,					\
+	},								\
+}
+
+static const struct iio_chan_spec bb_avr_dds_odometry_channels[] = {
+	BB_AVR_DDS_SPEED_CHANNEL(0),
+	BB_AVR_DDS_SPEED_CHANNEL(1),
+	BB_AVR_DDS_POSE_CHANNEL(IIO_DISTANCE, IIO_MOD_X, 2),
+	BB_AVR_DDS_POSE_CHANNEL(IIO_DISTANCE, IIO_MOD_Y, 3),
+	BB_AVR_DDS_POSE_CHANNEL(IIO_ANGL, IIO_NO_MOD, 4),
+	IIO_CHAN_SOFT_TIMESTAMP(5),
+};
+
 static const unsigned long bb_avr_dds_scan_masks[] = {0x3, 0};
+static const unsigned long bb_avr_dds_odometry_scan_masks[] = {0x1f, 0};
+
+/* layout of a sample, the pose is only filled in with odometry enabled */
+struct bb_avr_dds_scan {
+	__be16 speed[2];
+	s32 x;
+	s32 y;
+	s32 heading;
+	s64 timestamp;
+};
+
+/* Distance in micrometers travelled by a wheel in dt nanoseconds */
+static s64 bb_avr_dds_wheel_distance(struct bb_avr_dds_odometry *odometry,
+				     s16 speed, s64 dt)
+{
+	/* micrometers per second */
+	s64 velocity = div_s64((s64) speed * odometry->speed_scale *
+			       odometry->wheel_radius, 1000000);
+
+	return div_s64(velocity * dt, NSEC_PER_SEC);
+}
+
+static void bb_avr_dds_integrate(struct bb_avr_dds_odometry *odometry,
+				 const __be16 *speed, s64 timestamp)
+{
+	s64 dt = timestamp - odometry->timestamp;
+	s64 left, right, distance;
+	s32 dheading, heading, angle;
+
+	if (odometry->timestamp == 0 || dt <= 0) {
+		odometry->timestamp = timestamp;
+		return;
+	}
+	odometry->timestamp = timestamp;
+
+	left = bb_avr_dds_wheel_distance(odometry,
+					 (s16) be16_to_cpu(speed[0]), dt);
+	right = bb_avr_dds_wheel_distance(odometry,
+					  (s16) be16_to_cpu(speed[1]), dt);
+	distance = div_s64(left + right, 2);
+	dheading = div_s64((right - left) * 1000000, odometry->track_width);
+
+	/* move along the heading at the midpoint of the step */
+	heading = odometry->heading + dheading / 2;
+	heading %= BB_AVR_DDS_TWO_PI_URAD;
+	if (heading < 0)
+		heading += BB_AVR_DDS_TWO_PI_URAD;
+	angle = div_s64((s64) heading * BB_AVR_DDS_FIXP_TWO_PI,
+			BB_AVR_DDS_TWO_PI_URAD);
+	odometry->x += (distance *
+			fixp_cos32_rad(angle, BB_AVR_DDS_FIXP_TWO_PI)) >> 31;
+	odometry->y += (distance *
+			fixp_sin32_rad(angle, BB_AVR_DDS_FIXP_TWO_PI)) >> 31;
+
+	heading = (odometry->heading + dheading) % BB_AVR_DDS_TWO_PI_URAD;
+	if (heading < 0)
+		heading += BB_AVR_DDS_TWO_PI_URAD;
+	odometry->heading = heading;
+}
+
+static int bb_avr_dds_buffer_preenable(struct iio_dev *indio_dev)
+{
+	struct bb_avr_dds *dds = iio_priv(indio_dev);
+
+	/* start integrating from the origin */
+	dds->odometry.timestamp = 0;
+	dds->odometry.x = 0;
+	dds->odometry.y = 0;
+	dds->odometry.heading = 0;
+
+	return 0;
+}
+
+static const struct iio_buffer_setup_ops bb_avr_dds_buffer_setup_ops = {
+	.preenable   = bb_avr_dds_buffer_preenable,
+	.postenable  = iio_triggered_buffer_postenable,
+	.predisable  = iio_triggered_buffer_predisable,
+};
 
 static irqreturn_t bb_avr_dds_trigger_handler(int irq, void *p)
 {
 	struct iio_poll_func *pf = p;
 	struct iio_dev *indio_dev = pf->indio_dev;
 	struct bb_avr_dds *dds = iio_priv(indio_dev);
-	u8 rx_data[4];
+	struct bb_avr_dds_scan scan;
+	s64 timestamp;
 	int ret;
+	/* the pose and the padding before the timestamp may be unused */
+	memset(&scan, 0, sizeof(scan));
 	ret = bb_avr_exec(dds->avr, BB_AVR_CMD_GET_DDS_SPEED,
-			  NULL, 0, rx_data, ARRAY_SIZE(rx_data));
+			  NULL, 0, scan.speed, sizeof(scan.speed));
 	if (ret < 0)
 		goto out;
-	iio_push_to_buffers_with_timestamp(indio_dev, rx_data,
-					   iio_get_time_ns(indio_dev));
+	timestamp = iio_get_time_ns(indio_dev);
+	if (dds->odometry_enabled) {
+		bb_avr_dds_integrate(&dds->odometry, scan.speed, timestamp);
+		scan.x = dds->odometry.x;
+		scan.y = dds->odometry.y;
+		scan.heading = dds->odometry.heading;
+	}
+	iio_push_to_buffers_with_timestamp(indio_dev, &scan, timestamp);
 out:
 	iio_trigger_notify_done(indio_dev->trig);
 	return IRQ_HANDLED;
@@ -98,20 +254,39 @@ static int bb_avr_dds_probe(struct platform_device *pdev)
 	dds = iio_priv(indio_dev);
 	/* set the parent AVR device */
 	dds->avr = dev_get_drvdata(dev->parent);
+	/* odometry is enabled when the geometry of the robot is known */
+	dds->odometry_enabled =
+		!of_property_read_u32(dev->of_node, "ulb,wheel-radius-um",
+				      &dds->odometry.wheel_radius) &&
+		!of_property_read_u32(dev->of_node, "ulb,track-width-um",
+				      &dds->odometry.track_width) &&
+		!of_property_read_u32(dev->of_node, "ulb,speed-scale-urad",
+				      &dds->odometry.speed_scale) &&
+		dds->odometry.track_width > 0;
 	/* set up the indio_dev struct */
 	dev_set_drvdata(&pdev->dev, indio_dev);
 	indio_dev->name = "dds-sens";
 	indio_dev->dev.parent = &pdev->dev;
-	indio_dev->info = &bb_avr_dds_info;
 	indio_dev->direction = IIO_DEVICE_DIRECTION_IN;
 	indio_dev->modes = INDIO_BUFFER_SOFTWARE;
-	indio_dev->channels = bb_avr_dds_channels;
-	indio_dev->num_channels = ARRAY_SIZE(bb_avr_dds_channels);
-	indio_dev->available_scan_masks = bb_avr_dds_scan_masks;
+	if (dds->odometry_enabled) {
+		indio_dev->info = &bb_avr_dds_odometry_info;
+		indio_dev->channels = bb_avr_dds_odometry_channels;
+		indio_dev->num_channels =
+			ARRAY_SIZE(bb_avr_dds_odometry_channels);
+		indio_dev->available_scan_masks =
+			bb_avr_dds_odometry_scan_masks;
+	}
+	else {
+		indio_dev->info = &bb_avr_dds_info;
+		indio_dev->channels = bb_avr_dds_channels;
+		indio_dev->num_channels = ARRAY_SIZE(bb_avr_dds_channels);
+		indio_dev->available_scan_masks = bb_avr_dds_scan_masks;
+	}
 	ret = iio_triggered_buffer_setup(indio_dev,
 					 iio_pollfunc_store_time,
 					 bb_avr_dds_trigger_handler,
-					 NULL);
+					 &bb_avr_dds_buffer_setup_ops);
 	if(ret < 0)
 		goto err_out;
 	ret = iio_device_register(indio_dev);
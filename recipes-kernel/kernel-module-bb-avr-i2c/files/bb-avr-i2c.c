@@ -11,7 +11,9 @@
 #include <linux/i2c.h>
 #include <linux/kernel.h>
 #include <linux/mfd/bb-avr.h>
+#include <linux/mfd/bb-avr-i2c.h>
 #include <linux/module.h>
+#include <linux/of.h>
 #include <linux/of_device.h>
 #include <linux/platform_device.h>
 #include <linux/sched.h>
@@ -28,20 +30,32 @@ static const struct of_device_id bb_avr_i2c_of_match[] = {
  * struct bb_avr_i2c - BuilderBot AVR I2C Remote Bus
  *
  * @avr:	Pointer to parent BuilderBot AVR device
+ * @algorithm:	Algorithm of the adapter, without master_xfer if the
+ *		firmware lacks BB_AVR_CMD_I2C_WRITE_READ
  */
 struct bb_avr_i2c_dev {
 	struct bb_avr *avr;
    struct i2c_adapter adapter;
    struct platform_device *pdev;
+	struct bb_avr_i2c_algorithm algorithm;
 };
 
+/* address, register and count precede the data of block writes */
+#define BB_AVR_I2C_BLOCK_WRITE_MAX (BB_AVR_DATA_SIZE_MAX - 3)
+/* the count precedes the data of SMBus block reads */
+#define BB_AVR_I2C_BLOCK_READ_MAX (BB_AVR_DATA_SIZE_MAX - 1)
+/* address and both lengths precede the data of combined transfers */
+#define BB_AVR_I2C_XFER_WRITE_MAX (BB_AVR_DATA_SIZE_MAX - 3)
+#define BB_AVR_I2C_XFER_READ_MAX BB_AVR_DATA_SIZE_MAX
+
 static s32 bb_avr_smbus_xfer(struct i2c_adapter *adapter, u16 addr,
                              unsigned short flags, char read_write, u8 command,
                              int protocol, union i2c_smbus_data *data)
 {
    struct bb_avr_i2c_dev *dev = i2c_get_adapdata(adapter);
    int ret = 0;
-   u8 tx_data[3];
+   u8 tx_data[BB_AVR_DATA_SIZE_MAX];
+   u8 rx_data[BB_AVR_DATA_SIZE_MAX];
    /* device address */
    tx_data[0] = (addr & 0x7f);
    /* select the transfer protocol */
@@ -78,22 +92,61 @@ static s32 bb_avr_smbus_xfer(struct i2c_adapter *adapter, u16 addr,
          /* command is the source register */
          tx_data[1] = command;
          ret = bb_avr_exec(dev->avr, BB_AVR_CMD_READ_SMBUS_WORD_DATA,
-               		      tx_data, 2, &data->word, 2);
+               		      tx_data, 2, rx_data, 2);
+         /* SMBus words are transferred low byte first */
+         data->word = rx_data[0] | (rx_data[1] << 8);
+      }
+      else {
+         /* command is the destination register */
+         tx_data[1] = command;
+         tx_data[2] = data->word & 0xff;
+         tx_data[3] = data->word >> 8;
+         ret = bb_avr_exec(dev->avr, BB_AVR_CMD_WRITE_SMBUS_WORD_DATA,
+               		      tx_data, 4, NULL, 0);
+      }
+      break;
+   case I2C_SMBUS_BLOCK_DATA:
+      if(read_write == I2C_SMBUS_READ) {
+         /* command is the source register, the reply is always padded
+            to the requested maximum and starts with the actual count */
+         tx_data[1] = command;
+         tx_data[2] = BB_AVR_I2C_BLOCK_READ_MAX;
+         ret = bb_avr_exec(dev->avr, BB_AVR_CMD_READ_SMBUS_BLOCK_DATA,
+               		      tx_data, 3, rx_data, BB_AVR_I2C_BLOCK_READ_MAX + 1);
+         if(ret < 0)
+            break;
+         if(rx_data[0] == 0 || rx_data[0] > BB_AVR_I2C_BLOCK_READ_MAX)
+            return -EPROTO;
+         memcpy(data->block, rx_data, rx_data[0] + 1);
       }
       else {
-         return -EOPNOTSUPP;
+         /* command is the destination register */
+         if(data->block[0] == 0 || data->block[0] > BB_AVR_I2C_BLOCK_WRITE_MAX)
+            return -EINVAL;
+         tx_data[1] = command;
+         memcpy(tx_data + 2, data->block, data->block[0] + 1);
+         ret = bb_avr_exec(dev->avr, BB_AVR_CMD_WRITE_SMBUS_BLOCK_DATA,
+               		      tx_data, data->block[0] + 3, NULL, 0);
       }
       break;
    case I2C_SMBUS_I2C_BLOCK_DATA:
       if(read_write == I2C_SMBUS_READ) {
          /* command is the source register */
+         if(data->block[0] > BB_AVR_DATA_SIZE_MAX)
+            return -EINVAL;
          tx_data[1] = command;
          tx_data[2] = data->block[0];
          ret = bb_avr_exec(dev->avr, BB_AVR_CMD_READ_SMBUS_I2C_BLOCK_DATA,
                		      tx_data, 3, &data->block[1], data->block[0]);
       }
       else {
-         return -EOPNOTSUPP;
+         /* command is the destination register */
+         if(data->block[0] == 0 || data->block[0] > BB_AVR_I2C_BLOCK_WRITE_MAX)
+            return -EINVAL;
+         tx_data[1] = command;
+         memcpy(tx_data + 2, data->block, data->block[0] + 1);
+         ret = bb_avr_exec(dev->avr, BB_AVR_CMD_WRITE_SMBUS_I2C_BLOCK_DATA,
+               		      tx_data, data->block[0] + 3, NULL, 0);
       }
       break;
    default:
@@ -103,20 +156,214 @@ static s32 bb_avr_smbus_xfer(struct i2c_adapter *adapter, u16 addr,
    return ret;
 }
 
+/*
+ * Plain reads and writes as well as a write followed by a read from the
+ * same device (i.e. a register address and the register contents) are
+ * executed as a single BB_AVR_CMD_I2C_WRITE_READ command. The remaining
+ * limitations are described by bb_avr_i2c_quirks.
+ */
+static int bb_avr_i2c_xfer(struct i2c_adapter *adapter,
+			   struct i2c_msg *msgs, int num)
+{
+	struct bb_avr_i2c_dev *dev = i2c_get_adapdata(adapter);
+	struct i2c_msg *write = NULL, *read = NULL;
+	u8 tx_data[BB_AVR_DATA_SIZE_MAX];
+	int index, ret;
+
+	for (index = 0; index < num; index++) {
+		if (msgs[index].flags & (I2C_M_TEN | I2C_M_RECV_LEN))
+			return -EOPNOTSUPP;
+		if (msgs[index].addr != msgs[0].addr)
+			return -EOPNOTSUPP;
+		if (msgs[index].flags & I2C_M_RD) {
+			if (read)
+				return -EOPNOTSUPP;
+			read = &msgs[index];
+		} else {
+			if (write || read)
+				return -EOPNOTSUPP;
+			write = &msgs[index];
+		}
+	}
+
+	tx_data[0] = msgs[0].addr & 0x7f;
+	tx_data[1] = write ? write->len : 0;
+	tx_data[2] = read ? read->len : 0;
+	if (write)
+		memcpy(tx_data + 3, write->buf, write->len);
+
+	ret = bb_avr_exec(dev->avr, BB_AVR_CMD_I2C_WRITE_READ,
+			  tx_data, tx_data[1] + 3,
+			  read ? read->buf : NULL, tx_data[2]);
+	if (ret < 0)
+		return ret;
+
+	return num;
+}
+
 static u32 bb_avr_i2c_func(struct i2c_adapter *adapter)
 {
-	return (I2C_FUNC_SMBUS_BYTE |
+	/* master_xfer is only set if the firmware supports it */
+	u32 func = adapter->algo->master_xfer ? I2C_FUNC_I2C : 0;
+
+	return (func |
+           I2C_FUNC_SMBUS_BYTE |
            I2C_FUNC_SMBUS_BYTE_DATA |
-           I2C_FUNC_SMBUS_READ_WORD_DATA |
-           I2C_FUNC_SMBUS_READ_I2C_BLOCK);
+           I2C_FUNC_SMBUS_WORD_DATA |
+           I2C_FUNC_SMBUS_BLOCK_DATA |
+           I2C_FUNC_SMBUS_I2C_BLOCK);
+}
+
+static const struct i2c_adapter_quirks bb_avr_i2c_quirks = {
+	.flags			= I2C_AQ_COMB_WRITE_THEN_READ,
+	.max_num_msgs		= 2,
+	.max_write_len		= BB_AVR_I2C_XFER_WRITE_MAX,
+	.max_read_len		= BB_AVR_I2C_XFER_READ_MAX,
+	.max_comb_1st_msg_len	= BB_AVR_I2C_XFER_WRITE_MAX,
+	.max_comb_2nd_msg_len	= BB_AVR_I2C_XFER_READ_MAX,
+};
+
+/**
+ * struct bb_avr_i2c_mux - I2C mux that can be selected from a script
+ *
+ * @compatible:	Compatible string of the mux
+ * @enable:	Enable bit for muxes that select a single channel by number,
+ *		zero for muxes that select channels with a bit mask
+ */
+struct bb_avr_i2c_mux {
+	const char *compatible;
+	u8 enable;
+};
+
+static const struct bb_avr_i2c_mux bb_avr_i2c_muxes[] = {
+	{ .compatible = "nxp,pca9540", .enable = 0x04 },
+	{ .compatible = "nxp,pca9542", .enable = 0x04 },
+	{ .compatible = "nxp,pca9543", .enable = 0x00 },
+	{ .compatible = "nxp,pca9544", .enable = 0x04 },
+	{ .compatible = "nxp,pca9545", .enable = 0x00 },
+	{ .compatible = "nxp,pca9546", .enable = 0x00 },
+	{ .compatible = "nxp,pca9547", .enable = 0x08 },
+	{ .compatible = "nxp,pca9548", .enable = 0x00 },
+};
+
+/*
+ * Find the address of the mux in front of a muxed adapter and the value
+ * that has to be written to it to select the adapter's channel.
+ */
+static int bb_avr_i2c_mux_select_value(struct i2c_adapter *adapter,
+				       u8 *mux_addr, u8 *mux_value)
+{
+	struct device_node *mux_node;
+	u32 chan, addr;
+	size_t index;
+	int ret;
+
+	if (!adapter->dev.of_node)
+		return -EOPNOTSUPP;
+
+	ret = of_property_read_u32(adapter->dev.of_node, "reg", &chan);
+	if (ret < 0)
+		return ret;
+
+	mux_node = of_get_parent(adapter->dev.of_node);
+	ret = of_property_read_u32(mux_node, "reg", &addr);
+	if (ret < 0)
+		goto out;
+
+	ret = -EOPNOTSUPP;
+	for (index = 0; index < ARRAY_SIZE(bb_avr_i2c_muxes); index++) {
+		if (!of_device_is_compatible(mux_node,
+					     bb_avr_i2c_muxes[index].compatible))
+			continue;
+		*mux_addr = addr & 0x7f;
+		*mux_value = bb_avr_i2c_muxes[index].enable ?
+			(bb_avr_i2c_muxes[index].enable | chan) : BIT(chan);
+		ret = 0;
+		break;
+	}
+out:
+	of_node_put(mux_node);
+	return ret;
 }
 
-static struct i2c_algorithm bb_avr_i2c_algorithm = {
-//	.master_xfer	= bb_avr_i2c_rw,
-   .smbus_xfer = bb_avr_smbus_xfer,
-	.functionality	= bb_avr_i2c_func,
+static int bb_avr_i2c_script_xfer(struct i2c_adapter *adapter,
+				  const struct bb_avr_smbus_script *script,
+				  u8 *reply)
+{
+	struct i2c_adapter *root = i2c_root_adapter(&adapter->dev);
+	struct bb_avr_i2c_dev *dev = i2c_get_adapdata(root);
+	u8 tx_data[BB_AVR_DATA_SIZE_MAX];
+	u8 rx_data[BB_AVR_DATA_SIZE_MAX];
+	u8 *tx = tx_data;
+	u8 mux_addr, mux_value;
+	bool muxed = (adapter != root);
+	int ret;
+
+	if (muxed) {
+		/* only a single level of muxes is supported */
+		if (i2c_parent_is_i2c_adapter(adapter) != root)
+			return -EOPNOTSUPP;
+		ret = bb_avr_i2c_mux_select_value(adapter, &mux_addr, &mux_value);
+		if (ret < 0)
+			return ret;
+		/*
+		 * Select the channel and restore the previous selection
+		 * afterwards so that the state cached by the mux driver
+		 * remains valid
+		 */
+		*tx++ = BB_AVR_SMBUS_SCRIPT_PUSH_BYTE;
+		*tx++ = mux_addr;
+		*tx++ = mux_value;
+	}
+	memcpy(tx, script->data, script->length);
+	tx += script->length;
+	if (muxed) {
+		*tx++ = BB_AVR_SMBUS_SCRIPT_POP_BYTE;
+		*tx++ = mux_addr;
+	}
+
+	/* keep the mux driver and other clients off the bus */
+	i2c_lock_bus(adapter, I2C_LOCK_ROOT_ADAPTER);
+	/* the reply is a status byte followed by the data read */
+	ret = bb_avr_exec(dev->avr, BB_AVR_CMD_EXEC_SMBUS_SCRIPT,
+			  tx_data, tx - tx_data,
+			  rx_data, script->reply_length + 1);
+	i2c_unlock_bus(adapter, I2C_LOCK_ROOT_ADAPTER);
+
+	if (ret < 0)
+		return ret;
+	if (rx_data[0]) {
+		dev_dbg(&adapter->dev, "script failed at operation %u\n",
+			rx_data[0]);
+		return -EIO;
+	}
+	memcpy(reply, rx_data + 1, script->reply_length);
+	return 0;
+}
+
+static const struct bb_avr_i2c_algorithm bb_avr_i2c_algorithm = {
+	.algo = {
+		.master_xfer	= bb_avr_i2c_xfer,
+		.smbus_xfer	= bb_avr_smbus_xfer,
+		.functionality	= bb_avr_i2c_func,
+	},
+	.script_xfer = bb_avr_i2c_script_xfer,
 };
 
+/*
+ * AVR firmware without BB_AVR_CMD_I2C_WRITE_READ never replies to it.
+ * Send an empty transfer to the general call address, which no device acts
+ * on without a following command byte, so that plain I2C transfers are
+ * only offered when the firmware supports them.
+ */
+static bool bb_avr_i2c_probe_xfer(struct bb_avr_i2c_dev *dev)
+{
+	u8 tx_data[] = { 0x00, 0, 0 };
+
+	return bb_avr_exec(dev->avr, BB_AVR_CMD_I2C_WRITE_READ,
+			   tx_data, sizeof(tx_data), NULL, 0) == 0;
+}
+
 static int bb_avr_i2c_probe(struct platform_device *pdev)
 {
    struct bb_avr_i2c_dev *dev;
@@ -128,11 +375,19 @@ static int bb_avr_i2c_probe(struct platform_device *pdev)
    dev->adapter.owner = THIS_MODULE;
    dev->adapter.class = I2C_CLASS_DEPRECATED;
 	strlcpy(dev->adapter.name, "Builderbot AVR I2C adapter", sizeof(dev->adapter.name));
-	dev->adapter.algo = &bb_avr_i2c_algorithm;
 	dev->adapter.dev.parent = &(pdev->dev);
 	dev->adapter.dev.of_node = pdev->dev.of_node;
    /* get the parent avr device */
 	dev->avr = dev_get_drvdata(pdev->dev.parent);
+	dev->algorithm = bb_avr_i2c_algorithm;
+	if (bb_avr_i2c_probe_xfer(dev)) {
+		dev->adapter.quirks = &bb_avr_i2c_quirks;
+	} else {
+		dev_info(&pdev->dev,
+			 "AVR I2C transfers not supported, using SMBus only\n");
+		dev->algorithm.algo.master_xfer = NULL;
+	}
+	dev->adapter.algo = &dev->algorithm.algo;
 
    /* set our drvdata so we can access it in bb_avr_i2c_remove */
  	//dev_set_drvdata(&pdev->dev, dev);
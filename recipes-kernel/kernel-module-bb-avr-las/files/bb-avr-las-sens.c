@@ -30,66 +30,105 @@ static const struct of_device_id bb_avr_las_of_match[] = {
  * struct bb_avr_las - Lift actuator system sensor
  *
  * @avr: Pointer to parent BuilderBot AVR device
+ * @rf_composite: Also read the rangefinder in each tick
  */
 struct bb_avr_las {
 	struct bb_avr *avr;
+	bool rf_composite;
 };
 
 static const struct iio_info bb_avr_las_info = {};
 
+#define BB_AVR_LAS_CHANNELS			\
+	{					\
+		.type = IIO_DISTANCE,		\
+		.indexed = true,		\
+		.channel = 0,			\
+		.scan_index = 0,		\
+		.scan_type = {			\
+			.sign = 'u',		\
+			.realbits = 8,		\
+			.storagebits = 8,	\
+			.endianness = IIO_BE,	\
+		},				\
+	},					\
+	{					\
+		.type = IIO_PROXIMITY,		\
+		.indexed = true,		\
+		.channel = 0,			\
+		.scan_index = 1,		\
+		.scan_type = {			\
+			.sign = 'u',		\
+			.realbits = 1,		\
+			.storagebits = 8,	\
+			.endianness = IIO_BE,	\
+		},				\
+	},					\
+	{					\
+		.type = IIO_PROXIMITY,		\
+		.indexed = true,		\
+		.channel = 1,			\
+		.scan_index = 2,		\
+		.scan_type = {			\
+			.sign = 'u',		\
+			.realbits = 1,		\
+			.storagebits = 8,	\
+			.endianness = IIO_BE,	\
+		},				\
+	},					\
+	{					\
+		.type = IIO_INDEX,		\
+		.indexed = true,		\
+		.channel = 0,			\
+		.scan_index = 3,		\
+		.scan_type = {			\
+			.sign = 'u',		\
+			.realbits = 3,		\
+			.storagebits = 8,	\
+			.endianness = IIO_BE,	\
+		},				\
+	}
+
 static const struct iio_chan_spec bb_avr_las_channels[] = {
+	BB_AVR_LAS_CHANNELS,
+	IIO_CHAN_SOFT_TIMESTAMP(4),
+};
+
+/*
+ * In composite mode, the range and ambient readings of the rangefinder
+ * follow the lift actuator readings so that both share a timestamp
+ */
+static const struct iio_chan_spec bb_avr_las_rf_channels[] = {
+	BB_AVR_LAS_CHANNELS,
 	{
 		.type = IIO_DISTANCE,
 		.indexed = true,
-		.channel = 0,
-		.scan_index = 0,
-		.scan_type = {
-			.sign = 'u',
-			.realbits = 8,
-			.storagebits = 8,
-			.endianness = IIO_BE,
-		},
-	},
-	{
-		.type = IIO_PROXIMITY,
-		.indexed = true,
-		.channel = 0,
-		.scan_index = 1,
-		.scan_type = {
-			.sign = 'u',
-			.realbits = 1,
-			.storagebits = 8,
-			.endianness = IIO_BE,
-		},
-	},
-	{
-		.type = IIO_PROXIMITY,
-		.indexed = true,
 		.channel = 1,
-		.scan_index = 2,
+		.scan_index = 4,
 		.scan_type = {
 			.sign = 'u',
-			.realbits = 1,
-			.storagebits = 8,
+			.realbits = 16,
+			.storagebits = 16,
 			.endianness = IIO_BE,
 		},
 	},
 	{
-		.type = IIO_INDEX,
+		.type = IIO_INTENSITY,
 		.indexed = true,
 		.channel = 0,
-		.scan_index = 3,
+		.scan_index = 5,
 		.scan_type = {
 			.sign = 'u',
-			.realbits = 3,
-			.storagebits = 8,
+			.realbits = 16,
+			.storagebits = 16,
 			.endianness = IIO_BE,
 		},
 	},
-	IIO_CHAN_SOFT_TIMESTAMP(4),
+	IIO_CHAN_SOFT_TIMESTAMP(6),
 };
 
 static const unsigned long bb_avr_las_scan_masks[] = {0xf, 0};
+static const unsigned long bb_avr_las_rf_scan_masks[] = {0x3f, 0};
 
 static irqreturn_t bb_avr_las_trigger_handler(int irq, void *p)
 {
@@ -97,7 +136,8 @@ static irqreturn_t bb_avr_las_trigger_handler(int irq, void *p)
 	struct iio_dev *indio_dev = pf->indio_dev;
 	struct bb_avr_las *las = iio_priv(indio_dev);
 	int ret = 0;
-	u8 rx_data[4];
+	/* lift actuator, rangefinder and an aligned timestamp */
+	u8 rx_data[16] __aligned(8);
 
 	/* pull in remote data */
 	ret = bb_avr_exec(las->avr, BB_AVR_CMD_GET_LIFT_ACTUATOR_POSITION,
@@ -112,6 +152,16 @@ static irqreturn_t bb_avr_las_trigger_handler(int irq, void *p)
 			  NULL, 0, rx_data + 3, 1);
 	if (ret < 0)
 		goto out;
+	if (las->rf_composite) {
+		ret = bb_avr_exec(las->avr, BB_AVR_CMD_GET_RF_RANGE,
+				  NULL, 0, rx_data + 4, 2);
+		if (ret < 0)
+			goto out;
+		ret = bb_avr_exec(las->avr, BB_AVR_CMD_GET_RF_AMBIENT,
+				  NULL, 0, rx_data + 6, 2);
+		if (ret < 0)
+			goto out;
+	}
 	iio_push_to_buffers_with_timestamp(indio_dev, rx_data,
 					   iio_get_time_ns(indio_dev));
 out:
@@ -131,6 +181,9 @@ static int bb_avr_las_probe(struct platform_device *pdev)
 	las = iio_priv(indio_dev);
 	/* set the parent AVR device */
 	las->avr = dev_get_drvdata(pdev->dev.parent);
+	/* check whether the rangefinder should be read in the same tick */
+	las->rf_composite = of_property_read_bool(pdev->dev.of_node,
+						  "ulb,rf-composite");
 
 	/* set up the indio_dev struct */
 	dev_set_drvdata(&pdev->dev, indio_dev);
@@ -139,9 +192,16 @@ static int bb_avr_las_probe(struct platform_device *pdev)
 	indio_dev->info = &bb_avr_las_info;
 	indio_dev->direction = IIO_DEVICE_DIRECTION_IN;
 	indio_dev->modes = INDIO_BUFFER_SOFTWARE;
-	indio_dev->channels = bb_avr_las_channels;
-	indio_dev->num_channels = ARRAY_SIZE(bb_avr_las_channels);
-	indio_dev->available_scan_masks = bb_avr_las_scan_masks;
+	if (las->rf_composite) {
+		indio_dev->channels = bb_avr_las_rf_channels;
+		indio_dev->num_channels = ARRAY_SIZE(bb_avr_las_rf_channels);
+		indio_dev->available_scan_masks = bb_avr_las_rf_scan_masks;
+	}
+	else {
+		indio_dev->channels = bb_avr_las_channels;
+		indio_dev->num_channels = ARRAY_SIZE(bb_avr_las_channels);
+		indio_dev->available_scan_masks = bb_avr_las_scan_masks;
+	}
 	
 	ret = iio_triggered_buffer_setup(indio_dev,
 					 iio_pollfunc_store_time,
@@ -0,0 +1,350 @@
+// SPDX-License-Identifier: GPL-2.0+
+
+/*
+ * Battery and USB power supply driver for the BuilderBot
+ *
+ * The status is polled from the AVR in the background and cached, so
+ * that reading the power supply properties never touches the link to
+ * the AVR. Userspace is notified with a uevent only when a value changes.
+ */
+
+
+#include <linux/kernel.h>
+#include <linux/mfd/bb-avr.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/of_device.h>
+#include <linux/platform_device.h>
+#include <linux/power_supply.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+
+/* default interval between status updates */
+#define BB_AVR_PSY_POLL_INTERVAL_MS 5000
+/* interval before retrying when the link to the AVR was busy */
+#define BB_AVR_PSY_RETRY_INTERVAL_MS 100
+
+/*
+ * The PM AVR firmware is not part of this layer, so the replies below are
+ * the expected formats rather than documented ones. Each command is sent
+ * once at probe and only polled, and its power supply only registered, if
+ * the AVR replies with the expected length. The core ignores replies of a
+ * different length, so a mismatch would otherwise time out on every poll.
+ */
+/* reply to BB_AVR_CMD_GET_BATT_LVL: remaining capacity in percent */
+#define BB_AVR_PSY_BATT_LVL_RESP_LEN 1
+#define BB_AVR_PSY_CAPACITY_MAX 100
+/* reply to BB_AVR_CMD_GET_USB_STATUS: bit field */
+#define BB_AVR_PSY_USB_STATUS_RESP_LEN 1
+#define BB_AVR_PSY_USB_VBUS_PRESENT BIT(0)
+
+static const struct of_device_id bb_avr_psy_of_match[] = {
+	{ .compatible = "ulb,bb-avr-power-supply" },
+	{ /* sentinel */ }
+};
+
+/**
+ * struct bb_avr_psy_status - Cached status of the power supplies
+ *
+ * @capacity: Remaining battery capacity in percent
+ * @usb: USB status bit field
+ */
+struct bb_avr_psy_status {
+	u8 capacity;
+	u8 usb;
+};
+
+/**
+ * struct bb_avr_psy_query - Status command sent to the PM AVR
+ *
+ * @command: Command, only those of the PM AVR and the common ones
+ * @offset: Offset of the reply in struct bb_avr_psy_status
+ * @length: Expected length of the reply
+ */
+struct bb_avr_psy_query {
+	enum bb_avr_command command;
+	size_t offset;
+	size_t length;
+};
+
+enum bb_avr_psy_query_index {
+	BB_AVR_PSY_QUERY_BATT_LVL,
+	BB_AVR_PSY_QUERY_USB_STATUS,
+	BB_AVR_PSY_NUM_QUERIES,
+};
+
+static const struct bb_avr_psy_query bb_avr_psy_queries[] = {
+	[BB_AVR_PSY_QUERY_BATT_LVL] = {
+		.command = BB_AVR_CMD_GET_BATT_LVL,
+		.offset = offsetof(struct bb_avr_psy_status, capacity),
+		.length = BB_AVR_PSY_BATT_LVL_RESP_LEN,
+	},
+	[BB_AVR_PSY_QUERY_USB_STATUS] = {
+		.command = BB_AVR_CMD_GET_USB_STATUS,
+		.offset = offsetof(struct bb_avr_psy_status, usb),
+		.length = BB_AVR_PSY_USB_STATUS_RESP_LEN,
+	},
+};
+
+/**
+ * struct bb_avr_psy - BuilderBot AVR power supplies
+ *
+ * @dev: Pointer to the platform device
+ * @avr: Pointer to parent BuilderBot AVR device
+ * @battery: Battery power supply, NULL if the AVR does not report it
+ * @usb: USB power supply, NULL if the AVR does not report it
+ * @lock: Lock protecting @status
+ * @status: Last status read from the AVR
+ * @valid: Whether @status has been read at least once
+ * @queries: Bit mask of the queries the AVR replies to
+ * @pending: Status being read by @poll_work
+ * @query: Next query of @poll_work
+ * @poll_work: Work that updates @status
+ * @poll_interval: Interval between updates in jiffies
+ */
+struct bb_avr_psy {
+	struct device *dev;
+	struct bb_avr *avr;
+	struct power_supply *battery;
+	struct power_supply *usb;
+	struct mutex lock;
+	struct bb_avr_psy_status status;
+	bool valid;
+	unsigned int queries;
+	struct bb_avr_psy_status pending;
+	unsigned int query;
+	struct delayed_work poll_work;
+	unsigned long poll_interval;
+};
+
+static void bb_avr_psy_poll_work(struct work_struct *work)
+{
+	struct bb_avr_psy *psy =
+		container_of(work, struct bb_avr_psy, poll_work.work);
+	const struct bb_avr_psy_query *query;
+	struct bb_avr_psy_status *pending = &psy->pending;
+	bool battery_changed, usb_changed;
+	unsigned long delay = psy->poll_interval;
+	int ret;
+
+	/*
+	 * Each command is a separate frame. When the link is busy, retry the
+	 * command shortly and keep the replies already read.
+	 */
+	for (; psy->query < BB_AVR_PSY_NUM_QUERIES; psy->query++) {
+		if (!(psy->queries & BIT(psy->query)))
+			continue;
+		query = &bb_avr_psy_queries[psy->query];
+		ret = bb_avr_try_exec(psy->avr, query->command, NULL, 0,
+				      (u8 *) pending + query->offset,
+				      query->length);
+		if (ret == -EBUSY) {
+			/* control traffic has priority, try again shortly */
+			delay = msecs_to_jiffies(BB_AVR_PSY_RETRY_INTERVAL_MS);
+			goto out;
+		}
+		if (ret < 0) {
+			dev_dbg(psy->dev, "status update failed: %d\n",
+				ret);
+			psy->query = 0;
+			goto out;
+		}
+	}
+	psy->query = 0;
+
+	if ((psy->queries & BIT(BB_AVR_PSY_QUERY_BATT_LVL)) &&
+	    pending->capacity > BB_AVR_PSY_CAPACITY_MAX) {
+		dev_warn_ratelimited(psy->dev,
+				     "ignoring battery level %u\n",
+				     pending->capacity);
+		goto out;
+	}
+
+	mutex_lock(&psy->lock);
+	battery_changed = !psy->valid ||
+		pending->capacity != psy->status.capacity;
+	usb_changed = !psy->valid ||
+		(pending->usb ^ psy->status.usb) & BB_AVR_PSY_USB_VBUS_PRESENT;
+	psy->status = *pending;
+	psy->valid = true;
+	mutex_unlock(&psy->lock);
+
+	if (psy->battery && battery_changed)
+		power_supply_changed(psy->battery);
+	if (psy->usb && usb_changed)
+		power_supply_changed(psy->usb);
+out:
+	queue_delayed_work(system_power_efficient_wq, &psy->poll_work, delay);
+}
+
+static int bb_avr_psy_battery_get_property(struct power_supply *supply,
+					   enum power_supply_property prop,
+					   union power_supply_propval *val)
+{
+	struct bb_avr_psy *psy = power_supply_get_drvdata(supply);
+	int ret = 0;
+
+	mutex_lock(&psy->lock);
+	if (!psy->valid) {
+		ret = -ENODATA;
+		goto out;
+	}
+	switch (prop) {
+	case POWER_SUPPLY_PROP_PRESENT:
+		val->intval = 1;
+		break;
+	case POWER_SUPPLY_PROP_CAPACITY:
+		val->intval = psy->status.capacity;
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+out:
+	mutex_unlock(&psy->lock);
+	return ret;
+}
+
+static int bb_avr_psy_usb_get_property(struct power_supply *supply,
+				       enum power_supply_property prop,
+				       union power_supply_propval *val)
+{
+	struct bb_avr_psy *psy = power_supply_get_drvdata(supply);
+	int ret = 0;
+
+	if (prop != POWER_SUPPLY_PROP_ONLINE)
+		return -EINVAL;
+
+	mutex_lock(&psy->lock);
+	if (!psy->valid)
+		ret = -ENODATA;
+	else
+		val->intval = !!(psy->status.usb & BB_AVR_PSY_USB_VBUS_PRESENT);
+	mutex_unlock(&psy->lock);
+	return ret;
+}
+
+static enum power_supply_property bb_avr_psy_battery_props[] = {
+	POWER_SUPPLY_PROP_PRESENT,
+	POWER_SUPPLY_PROP_CAPACITY,
+};
+
+static enum power_supply_property bb_avr_psy_usb_props[] = {
+	POWER_SUPPLY_PROP_ONLINE,
+};
+
+static const struct power_supply_desc bb_avr_psy_battery_desc = {
+	.name = "bb-avr-battery",
+	.type = POWER_SUPPLY_TYPE_BATTERY,
+	.properties = bb_avr_psy_battery_props,
+	.num_properties = ARRAY_SIZE(bb_avr_psy_battery_props),
+	.get_property = bb_avr_psy_battery_get_property,
+};
+
+static const struct power_supply_desc bb_avr_psy_usb_desc = {
+	.name = "bb-avr-usb",
+	.type = POWER_SUPPLY_TYPE_USB,
+	.properties = bb_avr_psy_usb_props,
+	.num_properties = ARRAY_SIZE(bb_avr_psy_usb_props),
+	.get_property = bb_avr_psy_usb_get_property,
+};
+
+static char *bb_avr_psy_supplied_to[] = {
+	"bb-avr-battery",
+};
+
+/*
+ * Send each status command once and only keep those the AVR replies to
+ * with the expected length, see the reply formats above.
+ */
+static void bb_avr_psy_probe_queries(struct bb_avr_psy *psy)
+{
+	const struct bb_avr_psy_query *query;
+	unsigned int index;
+	int ret;
+
+	for (index = 0; index < BB_AVR_PSY_NUM_QUERIES; index++) {
+		query = &bb_avr_psy_queries[index];
+		ret = bb_avr_exec(psy->avr, query->command, NULL, 0,
+				  (u8 *) &psy->pending + query->offset,
+				  query->length);
+		if (ret < 0) {
+			dev_warn(psy->dev, "command 0x%02x not supported: %d\n",
+				 query->command, ret);
+			continue;
+		}
+		psy->queries |= BIT(index);
+	}
+}
+
+static int bb_avr_psy_probe(struct platform_device *pdev)
+{
+	struct device *dev = &pdev->dev;
+	struct power_supply_config cfg = { };
+	struct bb_avr_psy *psy;
+	u32 poll_interval_ms = BB_AVR_PSY_POLL_INTERVAL_MS;
+
+	psy = devm_kzalloc(dev, sizeof(*psy), GFP_KERNEL);
+	if (!psy)
+		return -ENOMEM;
+	psy->dev = dev;
+	/* get the parent AVR device */
+	psy->avr = dev_get_drvdata(dev->parent);
+	mutex_init(&psy->lock);
+	/* read the optional polling interval */
+	of_property_read_u32(dev->of_node, "poll-interval-ms", &poll_interval_ms);
+	psy->poll_interval = msecs_to_jiffies(poll_interval_ms);
+	INIT_DEFERRABLE_WORK(&psy->poll_work, bb_avr_psy_poll_work);
+
+	bb_avr_psy_probe_queries(psy);
+	if (!psy->queries)
+		return -ENODEV;
+
+	cfg.drv_data = psy;
+	cfg.of_node = dev->of_node;
+	if (psy->queries & BIT(BB_AVR_PSY_QUERY_BATT_LVL)) {
+		psy->battery = devm_power_supply_register(dev,
+						&bb_avr_psy_battery_desc, &cfg);
+		if (IS_ERR(psy->battery))
+			return PTR_ERR(psy->battery);
+		cfg.supplied_to = bb_avr_psy_supplied_to;
+		cfg.num_supplicants = ARRAY_SIZE(bb_avr_psy_supplied_to);
+	}
+	if (psy->queries & BIT(BB_AVR_PSY_QUERY_USB_STATUS)) {
+		psy->usb = devm_power_supply_register(dev, &bb_avr_psy_usb_desc,
+						      &cfg);
+		if (IS_ERR(psy->usb))
+			return PTR_ERR(psy->usb);
+	}
+
+	/* set drvdata so we can access it in bb_avr_psy_remove */
+	platform_set_drvdata(pdev, psy);
+
+	queue_delayed_work(system_power_efficient_wq, &psy->poll_work, 0);
+
+	return 0;
+}
+
+static int bb_avr_psy_remove(struct platform_device *pdev)
+{
+	struct bb_avr_psy *psy = platform_get_drvdata(pdev);
+
+	cancel_delayed_work_sync(&psy->poll_work);
+
+	return 0;
+}
+
+static struct platform_driver bb_avr_psy_driver = {
+	.probe = bb_avr_psy_probe,
+	.remove = bb_avr_psy_remove,
+	.driver = {
+		.name = "bb-avr-power-supply",
+		.of_match_table = bb_avr_psy_of_match,
+	},
+};
+
+module_platform_driver(bb_avr_psy_driver);
+
+MODULE_DEVICE_TABLE(of, bb_avr_psy_of_match);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("BuilderBot AVR Power Supply");
@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: GPL-2.0+
+
+/*
+ * Rangefinder sensor driver for the BuilderBot
+ *
+ * When the rangefinder should be sampled in the same tick as the lift
+ * actuator, the las-sens driver can read it instead (see the
+ * "ulb,rf-composite" property in bb-avr-las-sens.c) and this node can be
+ * left out of the device tree.
+ */
+
+
+#include <linux/delay.h>
+#include <linux/kernel.h>
+#include <linux/mfd/bb-avr.h>
+#include <linux/module.h>
+#include <linux/of_device.h>
+#include <linux/platform_device.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/sysfs.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
+
+static const struct of_device_id bb_avr_rf_of_match[] = {
+	{ .compatible = "ulb,bb-avr-rf-sens" },
+	{ /* sentinel */ }
+};
+
+/**
+ * struct bb_avr_rf - Rangefinder sensor
+ *
+ * @avr: Pointer to parent BuilderBot AVR device
+ */
+struct bb_avr_rf {
+	struct bb_avr *avr;
+};
+
+static int bb_avr_rf_read_raw(struct iio_dev *indio_dev,
+			      struct iio_chan_spec const *chan,
+			      int *val, int *val2, long mask)
+{
+	struct bb_avr_rf *rf = iio_priv(indio_dev);
+	enum bb_avr_command command;
+	__be16 rx_data;
+	int ret;
+
+	if (mask != IIO_CHAN_INFO_RAW)
+		return -EINVAL;
+
+	switch (chan->type) {
+	case IIO_DISTANCE:
+		command = BB_AVR_CMD_GET_RF_RANGE;
+		break;
+	case IIO_INTENSITY:
+		command = BB_AVR_CMD_GET_RF_AMBIENT;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	ret = iio_device_claim_direct_mode(indio_dev);
+	if (ret)
+		return ret;
+	ret = bb_avr_exec(rf->avr, command, NULL, 0,
+			  &rx_data, sizeof(rx_data));
+	iio_device_release_direct_mode(indio_dev);
+	if (ret < 0)
+		return ret;
+
+	*val = be16_to_cpu(rx_data);
+	return IIO_VAL_INT;
+}
+
+static const struct iio_info bb_avr_rf_info = {
+	.read_raw = bb_avr_rf_read_raw,
+};
+
+static const struct iio_chan_spec bb_avr_rf_channels[] = {
+	{
+		.type = IIO_DISTANCE,
+		.indexed = true,
+		.channel = 0,
+		.info_mask_separate = BIT(IIO_CHAN_INFO_RAW),
+		.scan_index = 0,
+		.scan_type = {
+			.sign = 'u',
+			.realbits = 16,
+			.storagebits = 16,
+			.endianness = IIO_BE,
+		},
+	},
+	{
+		.type = IIO_INTENSITY,
+		.indexed = true,
+		.channel = 0,
+		.info_mask_separate = BIT(IIO_CHAN_INFO_RAW),
+		.scan_index = 1,
+		.scan_type = {
+			.sign = 'u',
+			.realbits = 16,
+			.storagebits = 16,
+			.endianness = IIO_BE,
+		},
+	},
+	IIO_CHAN_SOFT_TIMESTAMP(2),
+};
+
+static const unsigned long bb_avr_rf_scan_masks[] = {0x1, 0x2, 0x3, 0};
+
+static irqreturn_t bb_avr_rf_trigger_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio_dev = pf->indio_dev;
+	struct bb_avr_rf *rf = iio_priv(indio_dev);
+	/* range and ambient plus an aligned timestamp */
+	__be16 rx_data[8] __aligned(8);
+	__be16 *dest = rx_data;
+	int ret = 0;
+
+	/* pull in remote data */
+	if (test_bit(0, indio_dev->active_scan_mask)) {
+		ret = bb_avr_exec(rf->avr, BB_AVR_CMD_GET_RF_RANGE,
+				  NULL, 0, dest++, sizeof(__be16));
+		if (ret < 0)
+			goto out;
+	}
+	if (test_bit(1, indio_dev->active_scan_mask)) {
+		ret = bb_avr_exec(rf->avr, BB_AVR_CMD_GET_RF_AMBIENT,
+				  NULL, 0, dest++, sizeof(__be16));
+		if (ret < 0)
+			goto out;
+	}
+	iio_push_to_buffers_with_timestamp(indio_dev, rx_data, pf->timestamp);
+out:
+	iio_trigger_notify_done(indio_dev->trig);
+	return IRQ_HANDLED;
+}
+
+static int bb_avr_rf_probe(struct platform_device *pdev)
+{
+	struct iio_dev *indio_dev;
+	struct bb_avr_rf *rf;
+	int ret = 0;
+
+	indio_dev = devm_iio_device_alloc(&pdev->dev, sizeof(*rf));
+	if (!indio_dev)
+		return -ENOMEM;
+	rf = iio_priv(indio_dev);
+	/* set the parent AVR device */
+	rf->avr = dev_get_drvdata(pdev->dev.parent);
+
+	/* set up the indio_dev struct */
+	dev_set_drvdata(&pdev->dev, indio_dev);
+	indio_dev->name = "rf-sens";
+	indio_dev->dev.parent = &pdev->dev;
+	indio_dev->info = &bb_avr_rf_info;
+	indio_dev->direction = IIO_DEVICE_DIRECTION_IN;
+	indio_dev->modes = INDIO_DIRECT_MODE | INDIO_BUFFER_SOFTWARE;
+	indio_dev->channels = bb_avr_rf_channels;
+	indio_dev->num_channels = ARRAY_SIZE(bb_avr_rf_channels);
+	indio_dev->available_scan_masks = bb_avr_rf_scan_masks;
+
+	ret = iio_triggered_buffer_setup(indio_dev,
+					 iio_pollfunc_store_time,
+					 bb_avr_rf_trigger_handler,
+					 NULL);
+	if(ret < 0)
+		goto err_out;
+	ret = iio_device_register(indio_dev);
+err_out:
+	return ret;
+}
+
+static int bb_avr_rf_remove(struct platform_device *pdev)
+{
+	struct iio_dev *indio_dev = platform_get_drvdata(pdev);
+
+	iio_triggered_buffer_cleanup(indio_dev);
+	iio_device_unregister(indio_dev);
+
+	return 0;
+}
+
+static struct platform_driver bb_avr_rf_driver = {
+	.probe = bb_avr_rf_probe,
+	.remove = bb_avr_rf_remove,
+	.driver = {
+		.name = "bb-avr-rf-sens",
+		.of_match_table = bb_avr_rf_of_match,
+	},
+};
+
+module_platform_driver(bb_avr_rf_driver);
+
+MODULE_DEVICE_TABLE(of, bb_avr_rf_of_match);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("BuilderBot AVR Rangefinder Sensor");
@@ -14,10 +14,12 @@
  */
 
 #include <linux/slab.h>
+#include <linux/gcd.h>
 #include <linux/i2c.h>
 #include <linux/log2.h>
 #include <linux/delay.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
 #include <linux/of_device.h>
 #include <linux/of_gpio.h>
 
@@ -33,6 +35,37 @@
 
 #define OV5640_XCLK_FIXED 24000000
 
+/* Limits of the PLL and of the single CSI2 data lane */
+#define OV5640_VCO_MIN 500000000UL
+#define OV5640_VCO_MAX 1000000000UL
+#define OV5640_LANE_RATE_MIN 80000000UL
+#define OV5640_LANE_RATE_MAX 672000000UL
+/* Share of the lane rate that the pixel data may use */
+#define OV5640_LANE_LOAD_PCT 80
+/* Pixel clock period (0x4837) from the init script at 336 Mbps */
+#define OV5640_PCLK_PERIOD_336M 0x2a
+
+/* Alignment and minimum size of the crop rectangle */
+#define OV5640_CROP_ALIGN_LEFT 2
+#define OV5640_CROP_ALIGN_TOP 2
+#define OV5640_CROP_ALIGN_WIDTH 16
+#define OV5640_CROP_ALIGN_HEIGHT 2
+#define OV5640_CROP_MIN_WIDTH 64
+#define OV5640_CROP_MIN_HEIGHT 16
+
+/* Longest auto-increment write, not counting the register address */
+#define OV5640_BURST_LEN 32
+/* Number of messages handed to the adapter in one transfer */
+#define OV5640_BURST_MSGS 8
+
+/* Registers in this window are shadowed by the driver */
+#define OV5640_REG_FIRST 0x3000
+#define OV5640_REG_LAST 0x5fff
+/* Registers held by the shadow, more than the driver ever writes */
+#define OV5640_REG_SHADOW_SIZE 256
+/* Number of dirty registers flushed per call to ov5640_reg_writes() */
+#define OV5640_SYNC_BATCH 64
+
 static struct of_device_id ov5640_dt_ids[] = {
 	{ .compatible = "omnivision,ov5640" },
 	{ }
@@ -45,6 +78,11 @@ static const struct i2c_device_id ov5640_i2c_id_table[] = {
 };
 MODULE_DEVICE_TABLE(i2c, ov5640_i2c_id_table);
 
+static bool warm_standby;
+module_param(warm_standby, bool, 0644);
+MODULE_PARM_DESC(warm_standby,
+		 "Idle in software power-down with PWDN deasserted for a fast restart (default: false)");
+
 struct ov5640_timing_cfg {
 	u16 x_addr_start;
 	u16 y_addr_start;
@@ -60,6 +98,9 @@ struct ov5640_timing_cfg {
 	u8 h_even_ss_inc;
 	u8 v_odd_ss_inc;
 	u8 v_even_ss_inc;
+	u8 sclk_div;
+	bool binning;
+	bool scaling;
 };
 
 struct ov5640_clk_cfg {
@@ -68,8 +109,49 @@ struct ov5640_clk_cfg {
 	u8 sc_pll_mult;
 	u8 sysclk_div;
 	u8 mipi_div;
+	u8 mipi_bits;
+};
+
+/**
+ * struct ov5640_format - Output format of the sensor
+ * @code: Media bus code
+ * @bpp: Bits per pixel on the CSI2 lane
+ * @mipi_bits: MIPI bit mode, 8 or 10 (0x3034)
+ * @fmt: Format control (0x4300)
+ * @mux: ISP format mux (0x501F), non-zero for raw data
+ * @colorspace: Colorspace of the data
+ */
+struct ov5640_format {
+	u32 code;
+	u8 bpp;
+	u8 mipi_bits;
+	u8 fmt;
+	u8 mux;
+	u32 colorspace;
 };
 
+static const struct ov5640_format ov5640_formats[] = {
+	{ MEDIA_BUS_FMT_UYVY8_1X16, 16, 8, 0x32, 0x00, V4L2_COLORSPACE_JPEG },
+	{ MEDIA_BUS_FMT_YUYV8_1X16, 16, 8, 0x30, 0x00, V4L2_COLORSPACE_JPEG },
+	/* raw data after defect pixel correction, ahead of the scaler */
+	{ MEDIA_BUS_FMT_SBGGR8_1X8, 8, 8, 0x00, 0x03, V4L2_COLORSPACE_SRGB },
+	{ MEDIA_BUS_FMT_SBGGR10_1X10, 10, 10, 0xf8, 0x03, V4L2_COLORSPACE_SRGB },
+};
+
+static const struct ov5640_format *ov5640_find_format(u32 code)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ov5640_formats); i++)
+		if (ov5640_formats[i].code == code)
+			return &ov5640_formats[i];
+
+	return NULL;
+}
+
+/* Frame rates offered by ov5640_enum_frame_interval(), if achievable */
+static const u8 ov5640_framerates[] = { 90, 60, 30, 15, 10, 5 };
+
 enum ov5640_size {
 	OV5640_SIZE_QVGA,
 	OV5640_SIZE_VGA,
@@ -87,29 +169,29 @@ static const struct v4l2_frmsize_discrete ov5640_frmsizes[OV5640_SIZE_LAST] = {
 	{ 2592, 1944 },
 };
 
-/* Find a frame size in an array */
-static int ov5640_find_framesize(u32 width, u32 height)
-{
-	int i;
-
-	for (i = 0; i < OV5640_SIZE_LAST; i++) {
-		if ((ov5640_frmsizes[i].width >= width) &&
-		    (ov5640_frmsizes[i].height >= height))
-			break;
-	}
-
-	/* If not found, select biggest */
-	if (i >= OV5640_SIZE_LAST)
-		i = OV5640_SIZE_LAST - 1;
-
-	return i;
-}
+/**
+ * struct ov5640_reg_shadow - shadowed register
+ * @reg: address of the register
+ * @val: value of the register
+ * @dirty: whether @val still has to be written to the sensor
+ */
+struct ov5640_reg_shadow {
+	u16 reg;
+	u8 val;
+	bool dirty;
+};
 
 struct ov5640 {
 	struct v4l2_subdev subdev;
 	struct media_pad pad;
 	struct v4l2_mbus_framefmt format;
 
+	/*
+	 * Serializes the subdev operations and the controls, which share
+	 * the register shadow and the stream state. Also the lock of @ctrls.
+	 */
+	struct mutex lock;
+
 	struct v4l2_ctrl_handler ctrls;
 	struct {
 		struct v4l2_ctrl *pixel_rate;
@@ -122,9 +204,22 @@ struct ov5640 {
 	struct gpio_desc* pwdn_gpio;
 	struct gpio_desc* avdd_gpio;
 	struct gpio_desc* dvdd_gpio;
+	bool pwdn;
 
 	/* System Clock config */
 	struct ov5640_clk_cfg clk_cfg;
+	struct v4l2_fract frame_interval;
+	u16 v_total_size;
+	bool streaming;
+
+	/* Mode, crop in output pixels of the mode, and resulting timing */
+	enum ov5640_size size;
+	struct v4l2_rect crop;
+	struct ov5640_timing_cfg timing;
+
+	/* Register shadow sorted by address, see ov5640_reg_update() */
+	struct ov5640_reg_shadow regs[OV5640_REG_SHADOW_SIZE];
+	unsigned int num_regs;
 };
 
 static inline struct ov5640 *to_ov5640(struct v4l2_subdev *sd)
@@ -266,37 +361,44 @@ static const struct ov5640_reg configscript_common2[] = {
 };
 
 static const struct ov5640_timing_cfg timing_cfg[OV5640_SIZE_LAST] = {
+	/* QVGA and VGA bin 2x2, which allows up to 90 fps */
 	[OV5640_SIZE_QVGA] = {
 		.x_addr_start = 0,
-		.y_addr_start = 0,
+		.y_addr_start = 4,
 		.x_addr_end = 2623,
-		.y_addr_end = 1951,
+		.y_addr_end = 1947,
 		.h_output_size = 320,
 		.v_output_size = 240,
-		.h_total_size = 2844,
-		.v_total_size = 1968,
+		.h_total_size = 1896,
+		.v_total_size = 984,
 		.isp_h_offset = 16,
 		.isp_v_offset = 6,
-		.h_odd_ss_inc = 1,
+		.h_odd_ss_inc = 3,
 		.h_even_ss_inc = 1,
-		.v_odd_ss_inc = 1,
+		.v_odd_ss_inc = 3,
 		.v_even_ss_inc = 1,
+		.sclk_div = 1,
+		.binning = true,
+		.scaling = true,
 	},
 	[OV5640_SIZE_VGA] = {
 		.x_addr_start = 0,
-		.y_addr_start = 0,
+		.y_addr_start = 4,
 		.x_addr_end = 2623,
-		.y_addr_end = 1951,
+		.y_addr_end = 1947,
 		.h_output_size = 640,
 		.v_output_size = 480,
-		.h_total_size = 2844,
-		.v_total_size = 1968,
+		.h_total_size = 1896,
+		.v_total_size = 984,
 		.isp_h_offset = 16,
 		.isp_v_offset = 6,
-		.h_odd_ss_inc = 1,
+		.h_odd_ss_inc = 3,
 		.h_even_ss_inc = 1,
-		.v_odd_ss_inc = 1,
+		.v_odd_ss_inc = 3,
 		.v_even_ss_inc = 1,
+		.sclk_div = 1,
+		.binning = true,
+		.scaling = true,
 	},
 	[OV5640_SIZE_720P] = {
 		.x_addr_start = 336,
@@ -313,6 +415,8 @@ static const struct ov5640_timing_cfg timing_cfg[OV5640_SIZE_LAST] = {
 		.h_even_ss_inc = 1,
 		.v_odd_ss_inc = 1,
 		.v_even_ss_inc = 1,
+		.sclk_div = 2,
+		.scaling = true,
 	},
 	[OV5640_SIZE_1080P] = {
 		.x_addr_start = 336,
@@ -329,6 +433,7 @@ static const struct ov5640_timing_cfg timing_cfg[OV5640_SIZE_LAST] = {
 		.h_even_ss_inc = 1,
 		.v_odd_ss_inc = 1,
 		.v_even_ss_inc = 1,
+		.sclk_div = 4,
 	},
 	[OV5640_SIZE_5MP] = {
 		.x_addr_start = 0,
@@ -345,9 +450,35 @@ static const struct ov5640_timing_cfg timing_cfg[OV5640_SIZE_LAST] = {
 		.h_even_ss_inc = 1,
 		.v_odd_ss_inc = 1,
 		.v_even_ss_inc = 1,
+		.sclk_div = 4,
 	},
 };
 
+/* Raw data is taken ahead of the scaler, so only unscaled modes work */
+static bool ov5640_size_supported(const struct ov5640_format *fmt, int size)
+{
+	return !fmt->mux || !timing_cfg[size].scaling;
+}
+
+/* Find a frame size in an array */
+static int ov5640_find_framesize(const struct ov5640_format *fmt,
+				 u32 width, u32 height)
+{
+	int i, last = OV5640_SIZE_LAST - 1;
+
+	for (i = 0; i < OV5640_SIZE_LAST; i++) {
+		if (!ov5640_size_supported(fmt, i))
+			continue;
+		last = i;
+		if ((ov5640_frmsizes[i].width >= width) &&
+		    (ov5640_frmsizes[i].height >= height))
+			break;
+	}
+
+	/* If not found, select biggest */
+	return last;
+}
+
 /**
  * ov5640_reg_read - Read a value from a register in an ov5640 sensor device
  * @client: i2c driver client structure
@@ -425,7 +556,9 @@ reg_write_err:
 
 /**
  * Initialize a list of ov5640 registers.
- * The list of registers is terminated by the pair of values
+ * Runs of consecutive register addresses are written as a single message,
+ * relying on the auto-increment of the register address, and several
+ * messages are handed to the adapter in each transfer.
  * @client: i2c driver client structure.
  * @reglist[]: List of address of the registers to write data.
  * Returns zero if successful, or non-zero otherwise.
@@ -434,39 +567,241 @@ static int ov5640_reg_writes(struct i2c_client *client,
 			     const struct ov5640_reg reglist[],
 			     int size)
 {
-	int err = 0, i;
+	u8 data[OV5640_BURST_MSGS][2 + OV5640_BURST_LEN];
+	struct i2c_msg msgs[OV5640_BURST_MSGS];
+	int ret, i = 0, first, len, num = 0;
+
+	while (i < size) {
+		first = i;
+		data[num][0] = (u8)(reglist[i].reg >> 8);
+		data[num][1] = (u8)(reglist[i].reg & 0xff);
+		len = 0;
+		do {
+			data[num][2 + len++] = reglist[i++].val;
+		} while (i < size && len < OV5640_BURST_LEN &&
+			 reglist[i].reg == reglist[i - 1].reg + 1);
+
+		msgs[num].addr = client->addr;
+		msgs[num].flags = 0;
+		msgs[num].len = 2 + len;
+		msgs[num].buf = data[num];
+		if (++num < OV5640_BURST_MSGS && i < size)
+			continue;
+
+		ret = i2c_transfer(client->adapter, msgs, num);
+		if (ret >= 0 && ret != num)
+			ret = -EIO;
+		if (ret < 0) {
+			dev_err(&client->dev,
+				"Failed writing registers from 0x%04x!\n",
+				reglist[first].reg);
+			return ret;
+		}
+		num = 0;
+	}
+	return 0;
+}
+
+static inline bool ov5640_reg_shadowed(u16 reg)
+{
+	return reg >= OV5640_REG_FIRST && reg <= OV5640_REG_LAST;
+}
+
+/**
+ * Forget the shadowed register values, i.e. after a reset of the sensor.
+ * @ov5640: ov5640 device.
+ */
+static void ov5640_reg_invalidate(struct ov5640 *ov5640)
+{
+	ov5640->num_regs = 0;
+}
+
+/**
+ * Find a register in the shadow.
+ * @ov5640: ov5640 device.
+ * @reg: Address of the register.
+ * @create: Whether to add the register if it is not in the shadow yet.
+ * Returns the shadowed register, or NULL if it is not in the shadow and
+ * either @create is false or the shadow is full.
+ */
+static struct ov5640_reg_shadow *ov5640_reg_lookup(struct ov5640 *ov5640,
+						   u16 reg, bool create)
+{
+	struct ov5640_reg_shadow *shadow;
+	unsigned int first = 0, last = ov5640->num_regs, mid;
+
+	while (first < last) {
+		mid = (first + last) / 2;
+		if (ov5640->regs[mid].reg == reg)
+			return &ov5640->regs[mid];
+		if (ov5640->regs[mid].reg < reg)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+
+	if (!create || ov5640->num_regs == OV5640_REG_SHADOW_SIZE)
+		return NULL;
+
+	shadow = &ov5640->regs[first];
+	memmove(shadow + 1, shadow,
+		(ov5640->num_regs - first) * sizeof(*shadow));
+	ov5640->num_regs++;
+	shadow->reg = reg;
+	shadow->dirty = false;
+	return shadow;
+}
+
+/**
+ * Write a list of registers to the sensor immediately and in order, then
+ * record the values in the shadow. Used for the init scripts, in which
+ * some registers are written more than once.
+ * @ov5640: ov5640 device.
+ * @reglist[]: List of address of the registers to write data.
+ * Returns zero if successful, or non-zero otherwise.
+ */
+static int ov5640_reg_load(struct ov5640 *ov5640,
+			   const struct ov5640_reg reglist[],
+			   int size)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(&ov5640->subdev);
+	struct ov5640_reg_shadow *shadow;
+	int ret, i;
+
+	ret = ov5640_reg_writes(client, reglist, size);
+	if (ret)
+		return ret;
 
 	for (i = 0; i < size; i++) {
-		err = ov5640_reg_write(client, reglist[i].reg,
-				reglist[i].val);
-		if (err)
-			return err;
+		if (!ov5640_reg_shadowed(reglist[i].reg))
+			continue;
+		shadow = ov5640_reg_lookup(ov5640, reglist[i].reg, true);
+		if (!shadow)
+			continue;
+		shadow->val = reglist[i].val;
+		shadow->dirty = false;
 	}
 	return 0;
 }
 
-static int ov5640_reg_set(struct i2c_client *client, u16 reg, u8 val)
+/**
+ * Update the bits in mask of a register in the shadow. The sensor is
+ * only read the first time a register is accessed and only written by
+ * ov5640_reg_sync(), if the value changed. Registers outside of the
+ * shadowed window, or that no longer fit in the shadow, are updated on
+ * the sensor directly.
+ * @ov5640: ov5640 device.
+ * @reg: Address of the register.
+ * @mask: Bits to update.
+ * @val: New value of the bits.
+ * Returns zero if successful, or non-zero otherwise.
+ */
+static int ov5640_reg_update(struct ov5640 *ov5640, u16 reg, u8 mask, u8 val)
 {
+	struct i2c_client *client = v4l2_get_subdevdata(&ov5640->subdev);
+	struct ov5640_reg_shadow *shadow = NULL;
+	bool shadowed = ov5640_reg_shadowed(reg);
 	int ret;
 	u8 tmpval = 0;
 
-	ret = ov5640_reg_read(client, reg, &tmpval);
+	if (shadowed)
+		shadow = ov5640_reg_lookup(ov5640, reg, false);
+
+	if (!shadow) {
+		if (mask != 0xff) {
+			ret = ov5640_reg_read(client, reg, &tmpval);
+			if (ret)
+				return ret;
+		}
+		if (shadowed)
+			shadow = ov5640_reg_lookup(ov5640, reg, true);
+		if (!shadow)
+			return ov5640_reg_write(client, reg, (tmpval & ~mask) |
+						(val & mask));
+		shadow->val = tmpval;
+		/* Unknown on the sensor unless read, so it has to be written */
+		shadow->dirty = mask == 0xff;
+	}
+
+	tmpval = (shadow->val & ~mask) | (val & mask);
+	if (tmpval != shadow->val) {
+		shadow->val = tmpval;
+		shadow->dirty = true;
+	}
+	return 0;
+}
+
+static int ov5640_reg_update_list(struct ov5640 *ov5640,
+				  const struct ov5640_reg reglist[],
+				  int size)
+{
+	int ret, i;
+
+	for (i = 0; i < size; i++) {
+		ret = ov5640_reg_update(ov5640, reglist[i].reg, 0xff,
+					reglist[i].val);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/**
+ * Write the dirty registers in the shadow to the sensor, in ascending
+ * order of address so that neighbouring registers share a burst.
+ * @ov5640: ov5640 device.
+ * Returns zero if successful, or non-zero otherwise.
+ */
+static int ov5640_reg_sync(struct ov5640 *ov5640)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(&ov5640->subdev);
+	struct ov5640_reg regs[OV5640_SYNC_BATCH];
+	int ret, i, num = 0;
+
+	for (i = 0; i < ov5640->num_regs; i++) {
+		if (!ov5640->regs[i].dirty)
+			continue;
+		regs[num].reg = ov5640->regs[i].reg;
+		regs[num].val = ov5640->regs[i].val;
+		if (++num < OV5640_SYNC_BATCH)
+			continue;
+		ret = ov5640_reg_writes(client, regs, num);
+		if (ret)
+			return ret;
+		num = 0;
+	}
+
+	if (num) {
+		ret = ov5640_reg_writes(client, regs, num);
+		if (ret)
+			return ret;
+	}
+
+	for (i = 0; i < ov5640->num_regs; i++)
+		ov5640->regs[i].dirty = false;
+	return 0;
+}
+
+static int ov5640_reg_set(struct ov5640 *ov5640, u16 reg, u8 val)
+{
+	int ret;
+
+	ret = ov5640_reg_update(ov5640, reg, val, val);
 	if (ret)
 		return ret;
 
-	return ov5640_reg_write(client, reg, tmpval | val);
+	return ov5640_reg_sync(ov5640);
 }
 
-static int ov5640_reg_clr(struct i2c_client *client, u16 reg, u8 val)
+static int ov5640_reg_clr(struct ov5640 *ov5640, u16 reg, u8 val)
 {
 	int ret;
-	u8 tmpval = 0;
 
-	ret = ov5640_reg_read(client, reg, &tmpval);
+	ret = ov5640_reg_update(ov5640, reg, val, 0);
 	if (ret)
 		return ret;
 
-	return ov5640_reg_write(client, reg, tmpval & ~val);
+	return ov5640_reg_sync(ov5640);
 }
 
 static unsigned long ov5640_get_pclk(struct v4l2_subdev *sd)
@@ -484,147 +819,266 @@ static unsigned long ov5640_get_pclk(struct v4l2_subdev *sd)
 	return mipi_pclk;
 }
 
-static int ov5640_config_timing(struct v4l2_subdev *sd)
+/*
+ * The timing generator runs from the MIPI clock divided by the PLL root
+ * divider, the bit divider (2 in 8-bit and 2.5 in 10-bit mode, see
+ * 0x3034) and the SCLK divider of the mode. A frame lasts HTS * VTS of
+ * these clocks.
+ */
+static unsigned long ov5640_get_sclk(unsigned long mipi_pclk,
+				     const struct ov5640_clk_cfg *clk,
+				     const struct ov5640_timing_cfg *cfg)
 {
-	struct i2c_client *client = v4l2_get_subdevdata(sd);
-	struct ov5640 *ov5640 = to_ov5640(sd);
-	int ret, i;
-
-	i = ov5640_find_framesize(ov5640->format.width, ov5640->format.height);
-
-	ret = ov5640_reg_write(client,
-			0x3800,
-			(timing_cfg[i].x_addr_start & 0xFF00) >> 8);
-	if (ret)
-		return ret;
-
-	ret = ov5640_reg_write(client,
-			0x3801,
-			timing_cfg[i].x_addr_start & 0xFF);
-	if (ret)
-		return ret;
+	return mipi_pclk / (clk->sc_pll_rdiv ? 2 : 1) * 4 / clk->mipi_bits /
+		cfg->sclk_div;
+}
 
-	ret = ov5640_reg_write(client,
-			0x3802,
-			(timing_cfg[i].y_addr_start & 0xFF00) >> 8);
-	if (ret)
-		return ret;
+/*
+ * Highest frame rate of a mode in mHz, limited either by the timing clock
+ * at the highest lane rate or by the pixel data that the lane can carry
+ */
+static u32 ov5640_max_framerate(const struct ov5640_clk_cfg *clk,
+				const struct ov5640_timing_cfg *cfg, u8 bpp)
+{
+	u64 sclk_max, lane_max;
 
-	ret = ov5640_reg_write(client,
-			0x3803,
-			timing_cfg[i].y_addr_start & 0xFF);
-	if (ret)
-		return ret;
+	sclk_max = ov5640_get_sclk(OV5640_LANE_RATE_MAX, clk, cfg);
+	lane_max = (u64)OV5640_LANE_RATE_MAX * OV5640_LANE_LOAD_PCT / 100;
 
-	ret = ov5640_reg_write(client,
-			0x3804,
-			(timing_cfg[i].x_addr_end & 0xFF00) >> 8);
-	if (ret)
-		return ret;
+	return min(div_u64(sclk_max * 1000,
+			   cfg->h_total_size * cfg->v_total_size),
+		   div_u64(lane_max * 1000, cfg->h_output_size *
+			   cfg->v_output_size * bpp));
+}
 
-	ret = ov5640_reg_write(client,
-			0x3805,
-			timing_cfg[i].x_addr_end & 0xFF);
-	if (ret)
-		return ret;
+/**
+ * Find the PLL settings and the VTS of a mode for a frame interval.
+ * The lowest lane rate that lets the mode run at the requested rate with
+ * the minimum VTS is picked, and VTS is then stretched to the exact rate.
+ * @ov5640: ov5640 device.
+ * @fmt: Output format.
+ * @cfg: Timing of the mode.
+ * @fi: Requested frame interval, updated to the one that was achieved.
+ * @clk: Resulting PLL settings.
+ * @vts: Resulting VTS.
+ */
+static void ov5640_solve_timing(struct ov5640 *ov5640,
+				const struct ov5640_format *fmt,
+				const struct ov5640_timing_cfg *cfg,
+				struct v4l2_fract *fi,
+				struct ov5640_clk_cfg *clk, u16 *vts)
+{
+	unsigned long pfd, vco, lane, best = 0, sclk, g;
+	u32 rate, hts = cfg->h_total_size;
+	u64 lane_min, frame;
+	unsigned int sysdiv, mult;
+
+	*clk = ov5640->clk_cfg;
+	clk->mipi_bits = fmt->mipi_bits;
+
+	/* requested rate in mHz, anything out of range is clamped */
+	rate = fi->numerator ?
+		div_u64((u64)fi->denominator * 1000, fi->numerator) : U32_MAX;
+	rate = clamp_t(u32, rate, 1000,
+		       ov5640_max_framerate(clk, cfg, fmt->bpp));
+
+	frame = (u64)hts * cfg->v_total_size;
+	lane_min = div_u64(div_u64(frame * rate, 1000) *
+			   (clk->sc_pll_rdiv ? 2 : 1) * clk->mipi_bits *
+			   cfg->sclk_div, 4);
+	lane_min = max_t(u64, lane_min, OV5640_LANE_RATE_MIN);
+
+	pfd = ov5640->xvclk / clk->sc_pll_prediv;
+	for (sysdiv = 1; sysdiv <= 15; sysdiv++) {
+		for (mult = 4; mult <= 252; mult += (mult < 128) ? 1 : 2) {
+			vco = pfd * mult;
+			if (vco < OV5640_VCO_MIN || vco > OV5640_VCO_MAX)
+				continue;
+			lane = vco / sysdiv / clk->mipi_div;
+			if (lane < lane_min || lane > OV5640_LANE_RATE_MAX)
+				continue;
+			if (best && lane >= best)
+				continue;
+			best = lane;
+			clk->sysclk_div = sysdiv;
+			clk->sc_pll_mult = mult;
+		}
+	}
 
-	ret = ov5640_reg_write(client,
-			0x3806,
-			(timing_cfg[i].y_addr_end & 0xFF00) >> 8);
-	if (ret)
-		return ret;
+	sclk = ov5640_get_sclk(best, clk, cfg);
+	*vts = clamp_t(u64, div_u64((u64)sclk * 1000, hts * rate),
+		       cfg->v_total_size, 0xffff);
 
-	ret = ov5640_reg_write(client,
-			0x3807,
-			timing_cfg[i].y_addr_end & 0xFF);
-	if (ret)
-		return ret;
+	g = gcd(hts * *vts, sclk);
+	fi->numerator = hts * *vts / g;
+	fi->denominator = sclk / g;
+}
 
-	ret = ov5640_reg_write(client,
-			0x3808,
-			(timing_cfg[i].h_output_size & 0xFF00) >> 8);
-	if (ret)
-		return ret;
+/*
+ * Shrink the array window of a mode to a crop rectangle given in output
+ * pixels of the mode. The ISP offsets and the scaling ratio of the mode
+ * are kept, and the minimum VTS drops by the rows that are not read out.
+ */
+static void ov5640_crop_timing(struct ov5640_timing_cfg *t,
+			       const struct v4l2_rect *crop)
+{
+	u32 sub_x = (t->h_odd_ss_inc + t->h_even_ss_inc) / 2;
+	u32 sub_y = (t->v_odd_ss_inc + t->v_even_ss_inc) / 2;
+	u32 rows = t->y_addr_end - t->y_addr_start + 1;
+	u32 in_w, in_h, x, y, w, h;
+
+	/* ISP input size of the full mode */
+	in_w = (t->x_addr_end - t->x_addr_start + 1) / sub_x -
+		2 * t->isp_h_offset;
+	in_h = rows / sub_y - 2 * t->isp_v_offset;
+
+	x = crop->left * in_w / t->h_output_size;
+	w = crop->width * in_w / t->h_output_size;
+	y = crop->top * in_h / t->v_output_size;
+	h = crop->height * in_h / t->v_output_size;
+
+	t->x_addr_start += round_down(x * sub_x, 2);
+	t->x_addr_end = t->x_addr_start +
+		(w + 2 * t->isp_h_offset) * sub_x - 1;
+	t->y_addr_start += round_down(y * sub_y, 2);
+	t->y_addr_end = t->y_addr_start +
+		(h + 2 * t->isp_v_offset) * sub_y - 1;
+	t->h_output_size = crop->width;
+	t->v_output_size = crop->height;
+	t->v_total_size -= (rows - (t->y_addr_end - t->y_addr_start + 1)) /
+		sub_y;
+}
 
-	ret = ov5640_reg_write(client,
-			0x3809,
-			timing_cfg[i].h_output_size & 0xFF);
-	if (ret)
-		return ret;
+/* Update the timing and PLL for the current mode, crop and interval */
+static void ov5640_update_timing(struct v4l2_subdev *sd)
+{
+	struct i2c_client *client = v4l2_get_subdevdata(sd);
+	struct ov5640 *ov5640 = to_ov5640(sd);
+	const struct ov5640_format *fmt =
+		ov5640_find_format(ov5640->format.code);
 
-	ret = ov5640_reg_write(client,
-			0x380A,
-			(timing_cfg[i].v_output_size & 0xFF00) >> 8);
-	if (ret)
-		return ret;
+	ov5640->timing = timing_cfg[ov5640->size];
+	ov5640_crop_timing(&ov5640->timing, &ov5640->crop);
 
-	ret = ov5640_reg_write(client,
-			0x380B,
-			timing_cfg[i].v_output_size & 0xFF);
-	if (ret)
-		return ret;
+	ov5640_solve_timing(ov5640, fmt, &ov5640->timing,
+			    &ov5640->frame_interval, &ov5640->clk_cfg,
+			    &ov5640->v_total_size);
 
-	ret = ov5640_reg_write(client,
-			0x380C,
-			(timing_cfg[i].h_total_size & 0xFF00) >> 8);
-	if (ret)
-		return ret;
+	/* changed: val64 was deprecated */
+	ov5640->pixel_rate->cur.val = ov5640_get_pclk(sd) / fmt->bpp;
+	dev_dbg(&client->dev, "%u/%u s per frame, pixel rate %d",
+		ov5640->frame_interval.numerator,
+		ov5640->frame_interval.denominator,
+		ov5640->pixel_rate->cur.val);
+}
 
-	ret = ov5640_reg_write(client,
-			0x380D,
-			timing_cfg[i].h_total_size & 0xFF);
-	if (ret)
-		return ret;
+/* Analog and black level settings of binned and full readout */
+static const struct ov5640_reg binning_regs[] = {
+	{ 0x3612, 0x29 },
+	{ 0x3618, 0x00 },
+	{ 0x3708, 0x64 },
+	{ 0x3709, 0x52 },
+	{ 0x370c, 0x03 },
+	{ 0x4004, 0x02 },
+};
 
-	ret = ov5640_reg_write(client,
-			0x380E,
-			(timing_cfg[i].v_total_size & 0xFF00) >> 8);
-	if (ret)
-		return ret;
+static const struct ov5640_reg full_regs[] = {
+	{ 0x3612, 0x4b },
+	{ 0x3618, 0x04 },
+	{ 0x3708, 0x21 },
+	{ 0x3709, 0x12 },
+	{ 0x370c, 0x00 },
+	{ 0x4004, 0x06 },
+};
 
-	ret = ov5640_reg_write(client,
-			0x380F,
-			timing_cfg[i].v_total_size & 0xFF);
-	if (ret)
-		return ret;
+static int ov5640_config_clocks(struct v4l2_subdev *sd)
+{
+	struct ov5640 *ov5640 = to_ov5640(sd);
+	const struct ov5640_clk_cfg *clk = &ov5640->clk_cfg;
+	const struct ov5640_timing_cfg *cfg = &ov5640->timing;
+	unsigned long mipi_pclk = ov5640_get_pclk(sd);
+	unsigned long sclk = ov5640_get_sclk(mipi_pclk, clk, cfg);
+	u16 vts = ov5640->v_total_size;
+	u16 b50 = sclk / cfg->h_total_size / 100;
+	u16 b60 = sclk / cfg->h_total_size / 120;
+	const struct ov5640_reg regs[] = {
+		{ 0x3034, 0x10 | clk->mipi_bits },
+		{ 0x3035, (clk->sysclk_div << 4) | clk->mipi_div },
+		{ 0x3036, clk->sc_pll_mult },
+		{ 0x3037, (clk->sc_pll_rdiv << 4) | clk->sc_pll_prediv },
+		{ 0x3108, ilog2(cfg->sclk_div) },
+		/* 50/60 Hz banding filter steps and bands per frame */
+		{ 0x3a08, b50 >> 8 },
+		{ 0x3a09, b50 & 0xFF },
+		{ 0x3a0a, b60 >> 8 },
+		{ 0x3a0b, b60 & 0xFF },
+		{ 0x3a0d, max_t(u16, vts / b60, 1) },
+		{ 0x3a0e, max_t(u16, vts / b50, 1) },
+		/*
+		 * Limit the exposure to the frame, otherwise AEC stretches
+		 * short frames of a cropped window
+		 */
+		{ 0x3a02, vts >> 8 },
+		{ 0x3a03, vts & 0xFF },
+		{ 0x3a14, vts >> 8 },
+		{ 0x3a15, vts & 0xFF },
+		{ 0x4837, DIV_ROUND_CLOSEST(OV5640_PCLK_PERIOD_336M * 336,
+					    mipi_pclk / 1000000) },
+	};
 
-	ret = ov5640_reg_write(client,
-			0x3810,
-			(timing_cfg[i].isp_h_offset & 0xFF00) >> 8);
-	if (ret)
-		return ret;
+	return ov5640_reg_update_list(ov5640, regs, ARRAY_SIZE(regs));
+}
 
-	ret = ov5640_reg_write(client,
-			0x3811,
-			timing_cfg[i].isp_h_offset & 0xFF);
-	if (ret)
-		return ret;
+static int ov5640_config_timing(struct v4l2_subdev *sd)
+{
+	struct ov5640 *ov5640 = to_ov5640(sd);
+	const struct ov5640_timing_cfg *cfg = &ov5640->timing;
+	/* 0x3800 to 0x3815 are consecutive and share a burst when synced */
+	const struct ov5640_reg regs[] = {
+		{ 0x3800, (cfg->x_addr_start & 0xFF00) >> 8 },
+		{ 0x3801, cfg->x_addr_start & 0xFF },
+		{ 0x3802, (cfg->y_addr_start & 0xFF00) >> 8 },
+		{ 0x3803, cfg->y_addr_start & 0xFF },
+		{ 0x3804, (cfg->x_addr_end & 0xFF00) >> 8 },
+		{ 0x3805, cfg->x_addr_end & 0xFF },
+		{ 0x3806, (cfg->y_addr_end & 0xFF00) >> 8 },
+		{ 0x3807, cfg->y_addr_end & 0xFF },
+		{ 0x3808, (cfg->h_output_size & 0xFF00) >> 8 },
+		{ 0x3809, cfg->h_output_size & 0xFF },
+		{ 0x380A, (cfg->v_output_size & 0xFF00) >> 8 },
+		{ 0x380B, cfg->v_output_size & 0xFF },
+		{ 0x380C, (cfg->h_total_size & 0xFF00) >> 8 },
+		{ 0x380D, cfg->h_total_size & 0xFF },
+		{ 0x380E, (ov5640->v_total_size & 0xFF00) >> 8 },
+		{ 0x380F, ov5640->v_total_size & 0xFF },
+		{ 0x3810, (cfg->isp_h_offset & 0xFF00) >> 8 },
+		{ 0x3811, cfg->isp_h_offset & 0xFF },
+		{ 0x3812, (cfg->isp_v_offset & 0xFF00) >> 8 },
+		{ 0x3813, cfg->isp_v_offset & 0xFF },
+		{ 0x3814, ((cfg->h_odd_ss_inc & 0xF) << 4) |
+			  (cfg->h_even_ss_inc & 0xF) },
+		{ 0x3815, ((cfg->v_odd_ss_inc & 0xF) << 4) |
+			  (cfg->v_even_ss_inc & 0xF) },
+	};
+	int ret;
 
-	ret = ov5640_reg_write(client,
-			0x3812,
-			(timing_cfg[i].isp_v_offset & 0xFF00) >> 8);
+	ret = ov5640_reg_update_list(ov5640, regs, ARRAY_SIZE(regs));
 	if (ret)
 		return ret;
 
-	ret = ov5640_reg_write(client,
-			0x3813,
-			timing_cfg[i].isp_v_offset & 0xFF);
+	ret = ov5640_reg_update(ov5640, 0x3820, 0x01, cfg->binning);
 	if (ret)
 		return ret;
 
-	ret = ov5640_reg_write(client,
-			0x3814,
-			((timing_cfg[i].h_odd_ss_inc & 0xF) << 4) |
-			(timing_cfg[i].h_even_ss_inc & 0xF));
+	ret = ov5640_reg_update(ov5640, 0x3821, 0x01, cfg->binning);
 	if (ret)
 		return ret;
 
-	ret = ov5640_reg_write(client,
-			0x3815,
-			((timing_cfg[i].v_odd_ss_inc & 0xF) << 4) |
-			(timing_cfg[i].v_even_ss_inc & 0xF));
-
-	return ret;
+	if (cfg->binning)
+		return ov5640_reg_update_list(ov5640, binning_regs,
+					      ARRAY_SIZE(binning_regs));
+	return ov5640_reg_update_list(ov5640, full_regs,
+				      ARRAY_SIZE(full_regs));
 }
 
 static struct v4l2_mbus_framefmt *
@@ -641,6 +1095,19 @@ __ov5640_get_pad_format(struct ov5640 *ov5640, struct v4l2_subdev_pad_config *cf
 	}
 }
 
+static struct v4l2_rect *
+__ov5640_get_pad_crop(struct ov5640 *ov5640, struct v4l2_subdev_pad_config *cfg,
+		      unsigned int pad, enum v4l2_subdev_format_whence which)
+{
+	switch (which) {
+	case V4L2_SUBDEV_FORMAT_TRY:
+		return v4l2_subdev_get_try_crop(&ov5640->subdev, cfg, pad);
+	case V4L2_SUBDEV_FORMAT_ACTIVE:
+		return &ov5640->crop;
+	default:
+		return NULL;
+	}
+}
 
 static void ov5640_power_up(struct v4l2_subdev *sd) {
 	struct ov5640 *ov5640 = to_ov5640(sd);
@@ -655,6 +1122,7 @@ static void ov5640_power_up(struct v4l2_subdev *sd) {
 	gpiod_set_value_cansleep(ov5640->xvclk_gpio, 1);
 	/* deassert power down */
 	gpiod_set_value_cansleep(ov5640->pwdn_gpio, 0);
+	ov5640->pwdn = false;
 	usleep_range(1000, 2000);
 	/* deassert reset */
 	gpiod_set_value_cansleep(ov5640->reset_gpio, 0);
@@ -670,6 +1138,7 @@ static void ov5640_power_down(struct v4l2_subdev *sd) {
 	gpiod_set_value_cansleep(ov5640->reset_gpio, 1);
 	/* assert power down */
 	gpiod_set_value_cansleep(ov5640->pwdn_gpio, 1);
+	ov5640->pwdn = true;
 	/* deassert clock enable */
 	gpiod_set_value_cansleep(ov5640->xvclk_gpio, 0);
 	/* deassert AVDD regulator enable */
@@ -683,22 +1152,47 @@ static void ov5640_power_down(struct v4l2_subdev *sd) {
  * V4L2 subdev internal operations
  */
 
+/*
+ * With warm_standby set, the sensor idles in software power-down (0x3008
+ * bit 6) with PWDN deasserted. Restarting the stream then only writes the
+ * registers that differ from the last configured mode and clears the
+ * power-down bit, without waiting for the sensor to come out of hardware
+ * standby.
+ */
 static int ov5640_s_power(struct v4l2_subdev *sd, int on)
 {
 	struct ov5640 *ov5640 = to_ov5640(sd);
 	struct i2c_client *client = v4l2_get_subdevdata(sd);
+	int ret = 0;
+
+	mutex_lock(&ov5640->lock);
+
+	/* PWDN already matches, or stays deasserted in warm standby */
+	if (!on == ov5640->pwdn)
+		goto out;
+
 	if (on) {
 		/* deassert power down */
 		gpiod_set_value_cansleep(ov5640->pwdn_gpio, 0);
+		ov5640->pwdn = false;
 		usleep_range(1000, 2000);
 		dev_dbg(&client->dev, "power down deasserted");
+	} else if (warm_standby) {
+		/* costs nothing if the stream was stopped before */
+		ret = ov5640_reg_set(ov5640, 0x3008, 0x40);
+		if (ret)
+			goto out;
+		dev_dbg(&client->dev, "software power down");
 	} else {
 		/* assert power down */
 		gpiod_set_value_cansleep(ov5640->pwdn_gpio, 1);
+		ov5640->pwdn = true;
 		usleep_range(1000, 2000);
 		dev_dbg(&client->dev, "power down asserted");
 	}
-	return 0;
+out:
+	mutex_unlock(&ov5640->lock);
+	return ret;
 }
 
 static struct v4l2_subdev_core_ops ov5640_subdev_core_ops = {
@@ -714,8 +1208,10 @@ static int ov5640_g_fmt(struct v4l2_subdev *sd,
 {
 	struct ov5640 *ov5640 = to_ov5640(sd);
 
+	mutex_lock(&ov5640->lock);
 	format->format = *__ov5640_get_pad_format(ov5640, cfg, format->pad,
 						  format->which);
+	mutex_unlock(&ov5640->lock);
 
 	return 0;
 }
@@ -725,36 +1221,154 @@ static int ov5640_s_fmt(struct v4l2_subdev *sd,
 			struct v4l2_subdev_format *format)
 {
 	struct ov5640 *ov5640 = to_ov5640(sd);
-	struct i2c_client *client = v4l2_get_subdevdata(sd);
+	const struct ov5640_format *fmt;
 	struct v4l2_mbus_framefmt *__format;
+	struct v4l2_rect *__crop;
+	int ret = 0;
+	int i;
+
+	mutex_lock(&ov5640->lock);
+
+	if (format->which == V4L2_SUBDEV_FORMAT_ACTIVE && ov5640->streaming) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	fmt = ov5640_find_format(format->format.code);
+	if (!fmt)
+		fmt = &ov5640_formats[0];
+	format->format.code = fmt->code;
+	format->format.field = V4L2_FIELD_NONE;
+	format->format.colorspace = fmt->colorspace;
 
 	__format = __ov5640_get_pad_format(ov5640, cfg, format->pad,
 					   format->which);
+	__crop = __ov5640_get_pad_crop(ov5640, cfg, format->pad,
+				       format->which);
+
+	/*
+	 * Keep the crop if the format matches it, otherwise select the mode
+	 * for the format and drop the crop
+	 */
+	if (format->format.width != __crop->width ||
+	    format->format.height != __crop->height ||
+	    (format->which == V4L2_SUBDEV_FORMAT_ACTIVE &&
+	     !ov5640_size_supported(fmt, ov5640->size))) {
+		i = ov5640_find_framesize(fmt, format->format.width,
+					  format->format.height);
+		__crop->left = 0;
+		__crop->top = 0;
+		__crop->width = ov5640_frmsizes[i].width;
+		__crop->height = ov5640_frmsizes[i].height;
+		if (format->which == V4L2_SUBDEV_FORMAT_ACTIVE)
+			ov5640->size = i;
+	}
+	format->format.width = __crop->width;
+	format->format.height = __crop->height;
 
 	*__format = format->format;
 
-	/* changed: val64 was deprecated */
-	ov5640->pixel_rate->cur.val = ov5640_get_pclk(sd) / 16;
-	dev_dbg(&client->dev, "set pixel rate to %d", ov5640->pixel_rate->cur.val);
+	/* the new mode may not reach the current frame rate */
+	if (format->which == V4L2_SUBDEV_FORMAT_ACTIVE)
+		ov5640_update_timing(sd);
 
-	return 0;
+out:
+	mutex_unlock(&ov5640->lock);
+	return ret;
+}
+
+static int ov5640_get_selection(struct v4l2_subdev *sd,
+				struct v4l2_subdev_pad_config *cfg,
+				struct v4l2_subdev_selection *sel)
+{
+	struct ov5640 *ov5640 = to_ov5640(sd);
+	int ret = 0;
+
+	mutex_lock(&ov5640->lock);
+	switch (sel->target) {
+	case V4L2_SEL_TGT_CROP:
+		sel->r = *__ov5640_get_pad_crop(ov5640, cfg, sel->pad,
+						sel->which);
+		break;
+	case V4L2_SEL_TGT_CROP_DEFAULT:
+	case V4L2_SEL_TGT_CROP_BOUNDS:
+		/* the whole output of the active mode */
+		sel->r.left = 0;
+		sel->r.top = 0;
+		sel->r.width = ov5640_frmsizes[ov5640->size].width;
+		sel->r.height = ov5640_frmsizes[ov5640->size].height;
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+	mutex_unlock(&ov5640->lock);
+	return ret;
+}
+
+/*
+ * The crop rectangle is in output pixels of the active mode. It narrows
+ * the array window, so that only the selected band is read out, scaled
+ * and sent over CSI2, and the format shrinks to the size of the crop.
+ */
+static int ov5640_set_selection(struct v4l2_subdev *sd,
+				struct v4l2_subdev_pad_config *cfg,
+				struct v4l2_subdev_selection *sel)
+{
+	struct ov5640 *ov5640 = to_ov5640(sd);
+	const struct v4l2_frmsize_discrete *bounds;
+	struct v4l2_mbus_framefmt *__format;
+	struct v4l2_rect *__crop;
+	struct v4l2_rect r;
+	int ret = 0;
+
+	if (sel->target != V4L2_SEL_TGT_CROP)
+		return -EINVAL;
+
+	mutex_lock(&ov5640->lock);
+
+	if (sel->which == V4L2_SUBDEV_FORMAT_ACTIVE && ov5640->streaming) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	bounds = &ov5640_frmsizes[ov5640->size];
+
+	r.left = clamp_t(s32, round_down(sel->r.left, OV5640_CROP_ALIGN_LEFT),
+			 0, bounds->width - OV5640_CROP_MIN_WIDTH);
+	r.top = clamp_t(s32, round_down(sel->r.top, OV5640_CROP_ALIGN_TOP),
+			0, bounds->height - OV5640_CROP_MIN_HEIGHT);
+	r.width = round_down(clamp_t(u32, sel->r.width, OV5640_CROP_MIN_WIDTH,
+				     bounds->width - r.left),
+			     OV5640_CROP_ALIGN_WIDTH);
+	r.height = round_down(clamp_t(u32, sel->r.height,
+				      OV5640_CROP_MIN_HEIGHT,
+				      bounds->height - r.top),
+			      OV5640_CROP_ALIGN_HEIGHT);
+
+	__crop = __ov5640_get_pad_crop(ov5640, cfg, sel->pad, sel->which);
+	__format = __ov5640_get_pad_format(ov5640, cfg, sel->pad, sel->which);
+	*__crop = r;
+	__format->width = r.width;
+	__format->height = r.height;
+	sel->r = r;
+
+	if (sel->which == V4L2_SUBDEV_FORMAT_ACTIVE)
+		ov5640_update_timing(sd);
+
+out:
+	mutex_unlock(&ov5640->lock);
+	return ret;
 }
 
 static int ov5640_enum_fmt(struct v4l2_subdev *subdev,
 			   struct v4l2_subdev_pad_config *cfg,
 			   struct v4l2_subdev_mbus_code_enum *code)
 {
-	if (code->index >= 2)
+	if (code->index >= ARRAY_SIZE(ov5640_formats))
 		return -EINVAL;
 
-	switch (code->index) {
-	case 0:
-		code->code = MEDIA_BUS_FMT_UYVY8_1X16;
-		break;
-	case 1:
-		code->code = MEDIA_BUS_FMT_YUYV8_1X16;
-		break;
-	}
+	code->code = ov5640_formats[code->index].code;
 	return 0;
 }
 
@@ -762,101 +1376,171 @@ static int ov5640_enum_framesizes(struct v4l2_subdev *subdev,
 				   struct v4l2_subdev_pad_config *cfg,
 				   struct v4l2_subdev_frame_size_enum *fse)
 {
-	if ((fse->index >= OV5640_SIZE_LAST) ||
-	    (fse->code != MEDIA_BUS_FMT_UYVY8_1X16 &&
-	     fse->code != MEDIA_BUS_FMT_YUYV8_1X16))
+	const struct ov5640_format *fmt = ov5640_find_format(fse->code);
+	unsigned int i, index = 0;
+
+	if (!fmt)
+		return -EINVAL;
+
+	for (i = 0; i < OV5640_SIZE_LAST; i++) {
+		if (!ov5640_size_supported(fmt, i))
+			continue;
+		if (index++ == fse->index) {
+			fse->min_width = ov5640_frmsizes[i].width;
+			fse->max_width = fse->min_width;
+			fse->min_height = ov5640_frmsizes[i].height;
+			fse->max_height = fse->min_height;
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+static int ov5640_enum_frame_interval(struct v4l2_subdev *sd,
+				      struct v4l2_subdev_pad_config *cfg,
+				      struct v4l2_subdev_frame_interval_enum *fie)
+{
+	struct ov5640 *ov5640 = to_ov5640(sd);
+	const struct ov5640_format *fmt = ov5640_find_format(fie->code);
+	const struct ov5640_timing_cfg *timing;
+	struct ov5640_clk_cfg clk;
+	unsigned int i, index = 0;
+	u32 max;
+
+	if (!fmt)
 		return -EINVAL;
 
-	fse->min_width = ov5640_frmsizes[fse->index].width;
-	fse->max_width = fse->min_width;
-	fse->min_height = ov5640_frmsizes[fse->index].height;
-	fse->max_height = fse->min_height;
+	/* the active format may be cropped from a larger mode */
+	if (fie->width == ov5640->format.width &&
+	    fie->height == ov5640->format.height)
+		timing = &ov5640->timing;
+	else
+		timing = &timing_cfg[ov5640_find_framesize(fmt, fie->width,
+							   fie->height)];
+	clk = ov5640->clk_cfg;
+	clk.mipi_bits = fmt->mipi_bits;
+	max = ov5640_max_framerate(&clk, timing, fmt->bpp);
+
+	for (i = 0; i < ARRAY_SIZE(ov5640_framerates); i++) {
+		if (ov5640_framerates[i] * 1000 > max)
+			continue;
+		if (index++ == fie->index) {
+			fie->interval.numerator = 1;
+			fie->interval.denominator = ov5640_framerates[i];
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+static int ov5640_g_frame_interval(struct v4l2_subdev *sd,
+				   struct v4l2_subdev_frame_interval *fi)
+{
+	struct ov5640 *ov5640 = to_ov5640(sd);
+
+	mutex_lock(&ov5640->lock);
+	fi->interval = ov5640->frame_interval;
+	mutex_unlock(&ov5640->lock);
 
 	return 0;
 }
 
+static int ov5640_s_frame_interval(struct v4l2_subdev *sd,
+				   struct v4l2_subdev_frame_interval *fi)
+{
+	struct ov5640 *ov5640 = to_ov5640(sd);
+	int ret = 0;
+
+	mutex_lock(&ov5640->lock);
+
+	if (ov5640->streaming) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	ov5640->frame_interval = fi->interval;
+	ov5640_update_timing(sd);
+	fi->interval = ov5640->frame_interval;
+
+out:
+	mutex_unlock(&ov5640->lock);
+	return ret;
+}
+
 static int ov5640_s_stream(struct v4l2_subdev *sd, int on)
 {
 	struct ov5640 *ov5640 = to_ov5640(sd);
-	struct i2c_client *client = v4l2_get_subdevdata(sd);
 	int ret = 0;
 
+	mutex_lock(&ov5640->lock);
+
 	if (on) {
-		u8 fmtreg = 0, fmtmuxreg = 0;
-		int i;
+		const struct ov5640_format *fmt =
+			ov5640_find_format(ov5640->format.code);
 
-		switch ((u32)ov5640->format.code) {
-		case MEDIA_BUS_FMT_UYVY8_1X16:
-			fmtreg = 0x32;
-			fmtmuxreg = 0;
-			break;
-		case MEDIA_BUS_FMT_YUYV8_1X16:
-			fmtreg = 0x30;
-			fmtmuxreg = 0;
-			break;
-		default:
+		if (!fmt) {
 			/* This shouldn't happen */
 			ret = -EINVAL;
-			return ret;
+			goto out;
 		}
 
-		ret = ov5640_reg_write(client, 0x4300, fmtreg);
+		ret = ov5640_reg_update(ov5640, 0x4300, 0xff, fmt->fmt);
 		if (ret)
-			return ret;
+			goto out;
 
-		ret = ov5640_reg_write(client, 0x501F, fmtmuxreg);
+		ret = ov5640_reg_update(ov5640, 0x501F, 0xff, fmt->mux);
 		if (ret)
-			return ret;
+			goto out;
 
-		ret = ov5640_config_timing(sd);
+		ret = ov5640_config_clocks(sd);
 		if (ret)
-			return ret;
+			goto out;
 
-		i = ov5640_find_framesize(ov5640->format.width, ov5640->format.height);
-		if ((i == OV5640_SIZE_QVGA) ||
-		    (i == OV5640_SIZE_VGA) ||
-		    (i == OV5640_SIZE_720P)) {
-			ret = ov5640_reg_write(client, 0x3108,
-					(i == OV5640_SIZE_720P) ? 0x1 : 0);
-			if (ret)
-				return ret;
-			ret = ov5640_reg_set(client, 0x5001, 0x20);
-		} else {
-			ret = ov5640_reg_clr(client, 0x5001, 0x20);
-			if (ret)
-				return ret;
-			ret = ov5640_reg_write(client, 0x3108, 0x2);
-		}
+		ret = ov5640_config_timing(sd);
+		if (ret)
+			goto out;
 
-		/* bring ov5640 out of power down mode */
-		ret = ov5640_reg_clr(client, 0x3008, 0x40);
+		/* scaling */
+		ret = ov5640_reg_update(ov5640, 0x5001, 0x20,
+					ov5640->timing.scaling ? 0x20 : 0);
 		if (ret)
 			goto out;
-	} else {
-		u8 tmpreg = 0;
 
-		ret = ov5640_reg_read(client, 0x3008, &tmpreg);
+		/* only the registers that changed since the last start */
+		ret = ov5640_reg_sync(ov5640);
 		if (ret)
 			goto out;
 
-		ret = ov5640_reg_write(client, 0x3008, tmpreg | 0x40);
+		/* bring ov5640 out of power down mode */
+		ret = ov5640_reg_clr(ov5640, 0x3008, 0x40);
+		if (ret)
+			goto out;
+	} else {
+		ret = ov5640_reg_set(ov5640, 0x3008, 0x40);
 		if (ret)
 			goto out;
 	}
+	ov5640->streaming = on;
 
 out:
+	mutex_unlock(&ov5640->lock);
 	return ret;
 }
 
 static struct v4l2_subdev_video_ops ov5640_subdev_video_ops = {
 	.s_stream	= ov5640_s_stream,
+	.g_frame_interval = ov5640_g_frame_interval,
+	.s_frame_interval = ov5640_s_frame_interval,
 };
 
 static struct v4l2_subdev_pad_ops ov5640_subdev_pad_ops = {
 	.enum_mbus_code = ov5640_enum_fmt,
 	.enum_frame_size = ov5640_enum_framesizes,
+	.enum_frame_interval = ov5640_enum_frame_interval,
 	.get_fmt = ov5640_g_fmt,
 	.set_fmt = ov5640_s_fmt,
+	.get_selection = ov5640_get_selection,
+	.set_selection = ov5640_set_selection,
 };
 
 static int ov5640_g_skip_frames(struct v4l2_subdev *sd, u32 *frames)
@@ -899,27 +1583,30 @@ static int ov5640_registered(struct v4l2_subdev *subdev)
 		 revision);
 
 	/* SW Reset */
-	ret = ov5640_reg_set(client, 0x3008, 0x80);
+	ov5640_reg_invalidate(ov5640);
+	ret = ov5640_reg_set(ov5640, 0x3008, 0x80);
 	if (ret)
 		goto err;
 
 	msleep(2);
 
-	ret = ov5640_reg_clr(client, 0x3008, 0x80);
+	/* the reset restored the default values */
+	ov5640_reg_invalidate(ov5640);
+	ret = ov5640_reg_clr(ov5640, 0x3008, 0x80);
 	if (ret)
 		goto err;
 
 	/* SW Powerdown */
-	ret = ov5640_reg_set(client, 0x3008, 0x40);
+	ret = ov5640_reg_set(ov5640, 0x3008, 0x40);
 	if (ret)
 		goto err;
 
-	ret = ov5640_reg_writes(client, configscript_common1,
+	ret = ov5640_reg_load(ov5640, configscript_common1,
 			ARRAY_SIZE(configscript_common1));
 	if (ret)
 		goto err;
 
-	ret = ov5640_reg_writes(client, configscript_common2,
+	ret = ov5640_reg_load(ov5640, configscript_common2,
 			ARRAY_SIZE(configscript_common2));
 	if (ret)
 		goto err;
@@ -934,9 +1621,18 @@ static int ov5640_registered(struct v4l2_subdev *subdev)
 					       V4L2_CID_PIXEL_RATE,
 					       1, INT_MAX, 1,
 					       ov5640_get_pclk(subdev) / 16);
+	if (ov5640->ctrls.error) {
+		ret = ov5640->ctrls.error;
+		v4l2_ctrl_handler_free(&ov5640->ctrls);
+		goto err;
+	}
 
+	ov5640->ctrls.lock = &ov5640->lock;
 	subdev->ctrl_handler = &ov5640->ctrls;
 
+	/* solve the PLL for the default format and frame interval */
+	ov5640_update_timing(subdev);
+
 	/* put the sensor into low power mode */
 	ov5640_s_power(subdev, 0);
 	return ret;
@@ -956,6 +1652,7 @@ static void ov5640_unregistered(struct v4l2_subdev *subdev) {
 static int ov5640_open(struct v4l2_subdev *subdev, struct v4l2_subdev_fh *fh)
 {
 	struct v4l2_mbus_framefmt *format;
+	struct v4l2_rect *crop;
 
 	format = v4l2_subdev_get_try_format(subdev, fh->pad, 0);
 	format->code = MEDIA_BUS_FMT_UYVY8_1X16;
@@ -964,6 +1661,12 @@ static int ov5640_open(struct v4l2_subdev *subdev, struct v4l2_subdev_fh *fh)
 	format->field = V4L2_FIELD_NONE;
 	format->colorspace = V4L2_COLORSPACE_JPEG;
 
+	crop = v4l2_subdev_get_try_crop(subdev, fh->pad, 0);
+	crop->left = 0;
+	crop->top = 0;
+	crop->width = format->width;
+	crop->height = format->height;
+
 	return 0;
 }
 
@@ -1033,23 +1736,36 @@ static int ov5640_probe(struct i2c_client *i2c,
 	if (!ov5640)
 		return -ENOMEM;
 
+	mutex_init(&ov5640->lock);
+
 	ret = ov5640_get_resources(ov5640, &i2c->dev);
 	if (ret) {
 		dev_err(&i2c->dev, "Failed to get resources!\n");
 		return ret;
 	}
 
+	/* the powerdown GPIO was requested asserted */
+	ov5640->pwdn = true;
+
 	ov5640->format.code = MEDIA_BUS_FMT_UYVY8_1X16;
 	ov5640->format.width = ov5640_frmsizes[OV5640_SIZE_VGA].width;
 	ov5640->format.height = ov5640_frmsizes[OV5640_SIZE_VGA].height;
 	ov5640->format.field = V4L2_FIELD_NONE;
 	ov5640->format.colorspace = V4L2_COLORSPACE_JPEG;
 
+	ov5640->size = OV5640_SIZE_VGA;
+	ov5640->crop.width = ov5640->format.width;
+	ov5640->crop.height = ov5640->format.height;
+
 	ov5640->clk_cfg.sc_pll_prediv = 3;
 	ov5640->clk_cfg.sc_pll_rdiv = 1;
 	ov5640->clk_cfg.sc_pll_mult = 84;
 	ov5640->clk_cfg.sysclk_div = 2;
 	ov5640->clk_cfg.mipi_div = 1;
+	ov5640->clk_cfg.mipi_bits = 8;
+
+	ov5640->frame_interval.numerator = 1;
+	ov5640->frame_interval.denominator = 30;
 
 	v4l2_i2c_subdev_init(&ov5640->subdev, i2c, &ov5640_subdev_ops);
 	ov5640->subdev.internal_ops = &ov5640_subdev_internal_ops;
@@ -1071,6 +1787,7 @@ static int ov5640_probe(struct i2c_client *i2c,
  err_entity_cleanup:
 	media_entity_cleanup(&ov5640->subdev.entity);
  err:
+	mutex_destroy(&ov5640->lock);
 	dev_err(&i2c->dev, "Probe failed: %d\n", ret);
 	return ret;
 }
@@ -1081,6 +1798,7 @@ static int ov5640_remove(struct i2c_client *i2c)
 	ov5640_power_down(subdev);
 	v4l2_async_unregister_subdev(subdev);
 	media_entity_cleanup(&subdev->entity);
+	mutex_destroy(&to_ov5640(subdev)->lock);
 	return 0;
 }
 
@@ -0,0 +1,763 @@
+// SPDX-License-Identifier: GPL-2.0+
+
+/*
+ * Emulated SC16IS762 for benchmarking the sc16is7xx driver.
+ *
+ * Registers an I2C adapter with a dual UART behind it and instantiates the
+ * sc16is7xx driver on it, so that the driver runs its regmap, interrupt and
+ * worker paths without the hardware. The TX of each channel is wired back
+ * to its RX. Characters leave the TX FIFO at the programmed baud rate and
+ * every transfer takes as long as it would on a bus clocked at bus_speed,
+ * so that round trips through the ports are paced like on the robot.
+ *
+ * Only what the driver uses is emulated: the FIFOs and their trigger
+ * levels, the RX, RX time-out and THR interrupts on a shared edge
+ * triggered line, the register sets selected by LCR, EFR and MCR and the
+ * software reset. Modem lines, flow control and the GPIOs are not.
+ */
+
+
+#include <linux/delay.h>
+#include <linux/hrtimer.h>
+#include <linux/i2c.h>
+#include <linux/irq.h>
+#include <linux/irq_work.h>
+#include <linux/kernel.h>
+#include <linux/kfifo.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+
+#define SC16IS7XX_EMU_ADDR		0x48
+#define SC16IS7XX_EMU_NR_UART		2
+#define SC16IS7XX_EMU_FIFO_SIZE		64
+
+/* General register set */
+#define SC16IS7XX_EMU_RHR_THR_REG	0x00
+#define SC16IS7XX_EMU_IER_REG		0x01
+#define SC16IS7XX_EMU_IIR_FCR_REG	0x02
+#define SC16IS7XX_EMU_LCR_REG		0x03
+#define SC16IS7XX_EMU_MCR_REG		0x04
+#define SC16IS7XX_EMU_LSR_REG		0x05
+#define SC16IS7XX_EMU_MSR_TCR_REG	0x06
+#define SC16IS7XX_EMU_SPR_TLR_REG	0x07
+#define SC16IS7XX_EMU_TXLVL_REG		0x08
+#define SC16IS7XX_EMU_RXLVL_REG		0x09
+#define SC16IS7XX_EMU_IODIR_REG		0x0a
+#define SC16IS7XX_EMU_IOSTATE_REG	0x0b
+#define SC16IS7XX_EMU_IOINTENA_REG	0x0c
+#define SC16IS7XX_EMU_IOCONTROL_REG	0x0e
+#define SC16IS7XX_EMU_EFCR_REG		0x0f
+
+/* Special register set, selected by LCR[7] */
+#define SC16IS7XX_EMU_DLL_REG		0x00
+#define SC16IS7XX_EMU_DLH_REG		0x01
+
+/* Enhanced register set, selected by LCR = 0xbf */
+#define SC16IS7XX_EMU_EFR_REG		0x02
+#define SC16IS7XX_EMU_XON1_REG		0x04
+#define SC16IS7XX_EMU_XOFF2_REG		0x07
+
+#define SC16IS7XX_EMU_IER_RDI_BIT	BIT(0)
+#define SC16IS7XX_EMU_IER_THRI_BIT	BIT(1)
+#define SC16IS7XX_EMU_IER_ENHANCED	0xf0
+
+#define SC16IS7XX_EMU_IIR_NO_INT_BIT	BIT(0)
+#define SC16IS7XX_EMU_IIR_RLSE_SRC	0x06
+#define SC16IS7XX_EMU_IIR_RTOI_SRC	0x0c
+#define SC16IS7XX_EMU_IIR_RDI_SRC	0x04
+#define SC16IS7XX_EMU_IIR_THRI_SRC	0x02
+#define SC16IS7XX_EMU_IIR_FIFOS_ENABLED	0xc0
+
+#define SC16IS7XX_EMU_FCR_FIFO_BIT	BIT(0)
+#define SC16IS7XX_EMU_FCR_RXRESET_BIT	BIT(1)
+#define SC16IS7XX_EMU_FCR_TXRESET_BIT	BIT(2)
+#define SC16IS7XX_EMU_FCR_TXLVL_MASK	0x30
+#define SC16IS7XX_EMU_FCR_TXLVL_SHIFT	4
+#define SC16IS7XX_EMU_FCR_RXLVL_SHIFT	6
+
+#define SC16IS7XX_EMU_LCR_LENGTH_MASK	0x03
+#define SC16IS7XX_EMU_LCR_STOPLEN_BIT	BIT(2)
+#define SC16IS7XX_EMU_LCR_PARITY_BIT	BIT(3)
+#define SC16IS7XX_EMU_LCR_DLAB_BIT	BIT(7)
+#define SC16IS7XX_EMU_LCR_CONF_MODE_B	0xbf
+#define SC16IS7XX_EMU_LCR_RESET		0x1d
+
+#define SC16IS7XX_EMU_MCR_TCRTLR_BIT	BIT(2)
+#define SC16IS7XX_EMU_MCR_CLKSEL_BIT	BIT(7)
+#define SC16IS7XX_EMU_MCR_ENHANCED	0xe0
+
+#define SC16IS7XX_EMU_LSR_DR_BIT	BIT(0)
+#define SC16IS7XX_EMU_LSR_OE_BIT	BIT(1)
+#define SC16IS7XX_EMU_LSR_THRE_BIT	BIT(5)
+#define SC16IS7XX_EMU_LSR_TEMT_BIT	BIT(6)
+
+#define SC16IS7XX_EMU_IOCONTROL_SRESET_BIT	BIT(3)
+
+#define SC16IS7XX_EMU_EFCR_RXDISABLE_BIT	BIT(1)
+#define SC16IS7XX_EMU_EFCR_TXDISABLE_BIT	BIT(2)
+
+#define SC16IS7XX_EMU_EFR_ENHANCED_BIT	BIT(4)
+
+/* Character times without a new character before the RX time-out */
+#define SC16IS7XX_EMU_RX_TIMEOUT_CHARS	4
+
+static unsigned long clock = 1843200;
+module_param(clock, ulong, 0444);
+MODULE_PARM_DESC(clock, "Frequency of the UART clock in Hz (default: 1843200)");
+
+static unsigned int bus_speed = 400000;
+module_param(bus_speed, uint, 0444);
+MODULE_PARM_DESC(bus_speed,
+		 "I2C bus clock the transfers are paced at in Hz (default: 400000, 0: not paced)");
+
+struct sc16is7xx_emu;
+
+/**
+ * struct sc16is7xx_emu_channel - Emulated UART channel
+ *
+ * @emu: Pointer to the emulated chip
+ * @tx_fifo: TX FIFO, not including the character being sent
+ * @rx_fifo: RX FIFO
+ * @tx_timer: Timer ending the transmission of @tx_char
+ * @rx_timer: Timer raising the RX time-out
+ * @tx_char: Character being sent
+ * @tx_busy: Whether @tx_char is being sent
+ * @thri: Whether the THR interrupt is pending
+ * @rx_timeout: Whether the RX time-out interrupt is pending
+ * @lsr_errors: Error bits of LSR, cleared by reading it
+ */
+struct sc16is7xx_emu_channel {
+	struct sc16is7xx_emu *emu;
+	DECLARE_KFIFO(tx_fifo, u8, SC16IS7XX_EMU_FIFO_SIZE);
+	DECLARE_KFIFO(rx_fifo, u8, SC16IS7XX_EMU_FIFO_SIZE);
+	struct hrtimer tx_timer;
+	struct hrtimer rx_timer;
+	u8 tx_char;
+	bool tx_busy;
+	bool thri;
+	bool rx_timeout;
+	u8 lsr_errors;
+	/* registers */
+	u8 ier;
+	u8 fcr;
+	u8 lcr;
+	u8 mcr;
+	u8 spr;
+	u8 dll;
+	u8 dlh;
+	u8 efr;
+	u8 xon_xoff[4];
+	u8 tcr;
+	u8 tlr;
+	u8 efcr;
+};
+
+/**
+ * struct sc16is7xx_emu - Emulated SC16IS762
+ *
+ * @adapter: I2C adapter the chip sits on
+ * @client: sc16is7xx client instantiated on @adapter
+ * @lock: Lock protecting the registers and FIFOs of the chip
+ * @chan: UART channels
+ * @irq: Interrupt line shared by the channels
+ * @irq_asserted: Whether a channel has an interrupt pending
+ * @irq_work: Work raising @irq from hard interrupt context
+ * @clock: UART clock frequency, passed as platform data
+ */
+struct sc16is7xx_emu {
+	struct i2c_adapter adapter;
+	struct i2c_client *client;
+	spinlock_t lock;
+	struct sc16is7xx_emu_channel chan[SC16IS7XX_EMU_NR_UART];
+	int irq;
+	bool irq_asserted;
+	struct irq_work irq_work;
+	unsigned long clock;
+	/* registers shared by the channels */
+	u8 iodir;
+	u8 iostate;
+	u8 iointena;
+	u8 iocontrol;
+};
+
+static struct sc16is7xx_emu *sc16is7xx_emu;
+
+static bool sc16is7xx_emu_enhanced(struct sc16is7xx_emu_channel *chan)
+{
+	return chan->efr & SC16IS7XX_EMU_EFR_ENHANCED_BIT;
+}
+
+/* TCR and TLR replace MSR and SPR with EFR[4] and MCR[2] set */
+static bool sc16is7xx_emu_tcrtlr(struct sc16is7xx_emu_channel *chan)
+{
+	return sc16is7xx_emu_enhanced(chan) &&
+	       (chan->mcr & SC16IS7XX_EMU_MCR_TCRTLR_BIT);
+}
+
+static unsigned int sc16is7xx_emu_rx_trigger(struct sc16is7xx_emu_channel *chan)
+{
+	static const u8 levels[] = { 8, 16, 56, 60 };
+
+	if (!(chan->fcr & SC16IS7XX_EMU_FCR_FIFO_BIT))
+		return 1;
+	if (chan->tlr >> 4)
+		return (chan->tlr >> 4) * 4;
+	return levels[chan->fcr >> SC16IS7XX_EMU_FCR_RXLVL_SHIFT];
+}
+
+/* Spaces in the TX FIFO at which the THR interrupt is raised */
+static unsigned int sc16is7xx_emu_tx_trigger(struct sc16is7xx_emu_channel *chan)
+{
+	static const u8 levels[] = { 8, 16, 32, 56 };
+
+	if (!(chan->fcr & SC16IS7XX_EMU_FCR_FIFO_BIT))
+		return SC16IS7XX_EMU_FIFO_SIZE;
+	if (chan->tlr & 0x0f)
+		return (chan->tlr & 0x0f) * 4;
+	return levels[(chan->fcr & SC16IS7XX_EMU_FCR_TXLVL_MASK) >>
+		      SC16IS7XX_EMU_FCR_TXLVL_SHIFT];
+}
+
+static unsigned int sc16is7xx_emu_tx_space(struct sc16is7xx_emu_channel *chan)
+{
+	return SC16IS7XX_EMU_FIFO_SIZE - kfifo_len(&chan->tx_fifo);
+}
+
+/* Time on the line of one character in ns, 0 while the clock is off */
+static u64 sc16is7xx_emu_char_ns(struct sc16is7xx_emu_channel *chan)
+{
+	unsigned int divisor = (chan->dlh << 8) | chan->dll;
+	unsigned int bits;
+
+	if (!divisor)
+		return 0;
+	if (chan->mcr & SC16IS7XX_EMU_MCR_CLKSEL_BIT)
+		divisor *= 4;
+
+	/* start bit, 5 to 8 data bits, parity bit and 1 or 2 stop bits */
+	bits = 1 + 5 + (chan->lcr & SC16IS7XX_EMU_LCR_LENGTH_MASK) +
+	       !!(chan->lcr & SC16IS7XX_EMU_LCR_PARITY_BIT) +
+	       ((chan->lcr & SC16IS7XX_EMU_LCR_STOPLEN_BIT) ? 2 : 1);
+
+	return div_u64((u64)bits * 16 * divisor * NSEC_PER_SEC,
+		       chan->emu->clock);
+}
+
+/* Interrupt of the highest priority pending on a channel */
+static u8 sc16is7xx_emu_iir(struct sc16is7xx_emu_channel *chan)
+{
+	if (chan->ier & SC16IS7XX_EMU_IER_RDI_BIT) {
+		if (chan->lsr_errors)
+			return SC16IS7XX_EMU_IIR_RLSE_SRC;
+		if (chan->rx_timeout)
+			return SC16IS7XX_EMU_IIR_RTOI_SRC;
+		if (kfifo_len(&chan->rx_fifo) >= sc16is7xx_emu_rx_trigger(chan))
+			return SC16IS7XX_EMU_IIR_RDI_SRC;
+	}
+	if ((chan->ier & SC16IS7XX_EMU_IER_THRI_BIT) && chan->thri)
+		return SC16IS7XX_EMU_IIR_THRI_SRC;
+
+	return SC16IS7XX_EMU_IIR_NO_INT_BIT;
+}
+
+/*
+ * The line is asserted while any channel has an interrupt pending, and
+ * the driver asks for its falling edge, so only raise the interrupt when
+ * the line goes from idle to asserted.
+ */
+static void sc16is7xx_emu_update_irq(struct sc16is7xx_emu *emu)
+{
+	bool asserted = false;
+	int i;
+
+	for (i = 0; i < SC16IS7XX_EMU_NR_UART; i++)
+		if (sc16is7xx_emu_iir(&emu->chan[i]) !=
+		    SC16IS7XX_EMU_IIR_NO_INT_BIT)
+			asserted = true;
+
+	if (asserted && !emu->irq_asserted)
+		irq_work_queue(&emu->irq_work);
+	emu->irq_asserted = asserted;
+}
+
+static void sc16is7xx_emu_start_rx_timeout(struct sc16is7xx_emu_channel *chan)
+{
+	u64 timeout = SC16IS7XX_EMU_RX_TIMEOUT_CHARS *
+		      sc16is7xx_emu_char_ns(chan);
+
+	chan->rx_timeout = false;
+	hrtimer_start(&chan->rx_timer, ns_to_ktime(timeout), HRTIMER_MODE_REL);
+}
+
+static void sc16is7xx_emu_start_tx(struct sc16is7xx_emu_channel *chan)
+{
+	u64 char_ns = sc16is7xx_emu_char_ns(chan);
+
+	if (chan->tx_busy || !char_ns ||
+	    (chan->efcr & SC16IS7XX_EMU_EFCR_TXDISABLE_BIT) ||
+	    !kfifo_get(&chan->tx_fifo, &chan->tx_char))
+		return;
+
+	chan->tx_busy = true;
+	if (sc16is7xx_emu_tx_space(chan) == sc16is7xx_emu_tx_trigger(chan))
+		chan->thri = true;
+	hrtimer_start(&chan->tx_timer, ns_to_ktime(char_ns), HRTIMER_MODE_REL);
+}
+
+static void sc16is7xx_emu_receive(struct sc16is7xx_emu_channel *chan, u8 val)
+{
+	if (chan->efcr & SC16IS7XX_EMU_EFCR_RXDISABLE_BIT)
+		return;
+
+	if (!kfifo_put(&chan->rx_fifo, val))
+		chan->lsr_errors |= SC16IS7XX_EMU_LSR_OE_BIT;
+	sc16is7xx_emu_start_rx_timeout(chan);
+}
+
+static enum hrtimer_restart sc16is7xx_emu_tx_timer(struct hrtimer *timer)
+{
+	struct sc16is7xx_emu_channel *chan =
+		container_of(timer, struct sc16is7xx_emu_channel, tx_timer);
+	struct sc16is7xx_emu *emu = chan->emu;
+	unsigned long flags;
+
+	spin_lock_irqsave(&emu->lock, flags);
+	chan->tx_busy = false;
+	/* TX is wired to RX */
+	sc16is7xx_emu_receive(chan, chan->tx_char);
+	sc16is7xx_emu_start_tx(chan);
+	sc16is7xx_emu_update_irq(emu);
+	spin_unlock_irqrestore(&emu->lock, flags);
+
+	return HRTIMER_NORESTART;
+}
+
+static enum hrtimer_restart sc16is7xx_emu_rx_timer(struct hrtimer *timer)
+{
+	struct sc16is7xx_emu_channel *chan =
+		container_of(timer, struct sc16is7xx_emu_channel, rx_timer);
+	struct sc16is7xx_emu *emu = chan->emu;
+	unsigned long flags;
+
+	spin_lock_irqsave(&emu->lock, flags);
+	if (!kfifo_is_empty(&chan->rx_fifo)) {
+		chan->rx_timeout = true;
+		sc16is7xx_emu_update_irq(emu);
+	}
+	spin_unlock_irqrestore(&emu->lock, flags);
+
+	return HRTIMER_NORESTART;
+}
+
+static void sc16is7xx_emu_reset(struct sc16is7xx_emu *emu)
+{
+	struct sc16is7xx_emu_channel *chan;
+	int i;
+
+	for (i = 0; i < SC16IS7XX_EMU_NR_UART; i++) {
+		chan = &emu->chan[i];
+		kfifo_reset(&chan->tx_fifo);
+		kfifo_reset(&chan->rx_fifo);
+		chan->thri = false;
+		chan->rx_timeout = false;
+		chan->lsr_errors = 0;
+		chan->ier = 0;
+		chan->fcr = 0;
+		chan->lcr = SC16IS7XX_EMU_LCR_RESET;
+		chan->mcr = 0;
+		chan->efr = 0;
+		chan->tcr = 0;
+		chan->tlr = 0;
+		chan->efcr = 0;
+	}
+	emu->iodir = 0;
+	emu->iostate = 0;
+	emu->iointena = 0;
+	emu->iocontrol = 0;
+}
+
+static u8 sc16is7xx_emu_read(struct sc16is7xx_emu_channel *chan, u8 reg)
+{
+	struct sc16is7xx_emu *emu = chan->emu;
+	u8 val;
+
+	if (chan->lcr == SC16IS7XX_EMU_LCR_CONF_MODE_B) {
+		if (reg == SC16IS7XX_EMU_EFR_REG)
+			return chan->efr;
+		if (reg >= SC16IS7XX_EMU_XON1_REG &&
+		    reg <= SC16IS7XX_EMU_XOFF2_REG)
+			return chan->xon_xoff[reg - SC16IS7XX_EMU_XON1_REG];
+	} else if (chan->lcr & SC16IS7XX_EMU_LCR_DLAB_BIT) {
+		if (reg == SC16IS7XX_EMU_DLL_REG)
+			return chan->dll;
+		if (reg == SC16IS7XX_EMU_DLH_REG)
+			return chan->dlh;
+	}
+
+	switch (reg) {
+	case SC16IS7XX_EMU_RHR_THR_REG:
+		if (!kfifo_get(&chan->rx_fifo, &val))
+			val = 0;
+		/* reading RHR restarts the RX time-out */
+		chan->rx_timeout = false;
+		if (!kfifo_is_empty(&chan->rx_fifo))
+			sc16is7xx_emu_start_rx_timeout(chan);
+		return val;
+	case SC16IS7XX_EMU_IER_REG:
+		return chan->ier;
+	case SC16IS7XX_EMU_IIR_FCR_REG:
+		val = sc16is7xx_emu_iir(chan);
+		/* reading IIR clears the THR interrupt it reports */
+		if (val == SC16IS7XX_EMU_IIR_THRI_SRC)
+			chan->thri = false;
+		if (chan->fcr & SC16IS7XX_EMU_FCR_FIFO_BIT)
+			val |= SC16IS7XX_EMU_IIR_FIFOS_ENABLED;
+		return val;
+	case SC16IS7XX_EMU_LCR_REG:
+		return chan->lcr;
+	case SC16IS7XX_EMU_MCR_REG:
+		return chan->mcr;
+	case SC16IS7XX_EMU_LSR_REG:
+		val = chan->lsr_errors;
+		chan->lsr_errors = 0;
+		if (!kfifo_is_empty(&chan->rx_fifo))
+			val |= SC16IS7XX_EMU_LSR_DR_BIT;
+		if (kfifo_is_empty(&chan->tx_fifo)) {
+			val |= SC16IS7XX_EMU_LSR_THRE_BIT;
+			if (!chan->tx_busy)
+				val |= SC16IS7XX_EMU_LSR_TEMT_BIT;
+		}
+		return val;
+	case SC16IS7XX_EMU_MSR_TCR_REG:
+		return sc16is7xx_emu_tcrtlr(chan) ? chan->tcr : 0;
+	case SC16IS7XX_EMU_SPR_TLR_REG:
+		return sc16is7xx_emu_tcrtlr(chan) ? chan->tlr : chan->spr;
+	case SC16IS7XX_EMU_TXLVL_REG:
+		return sc16is7xx_emu_tx_space(chan);
+	case SC16IS7XX_EMU_RXLVL_REG:
+		return kfifo_len(&chan->rx_fifo);
+	case SC16IS7XX_EMU_IODIR_REG:
+		return emu->iodir;
+	case SC16IS7XX_EMU_IOSTATE_REG:
+		return emu->iostate;
+	case SC16IS7XX_EMU_IOINTENA_REG:
+		return emu->iointena;
+	case SC16IS7XX_EMU_IOCONTROL_REG:
+		return emu->iocontrol;
+	case SC16IS7XX_EMU_EFCR_REG:
+		return chan->efcr;
+	default:
+		return 0;
+	}
+}
+
+static void sc16is7xx_emu_write(struct sc16is7xx_emu_channel *chan, u8 reg,
+				u8 val)
+{
+	struct sc16is7xx_emu *emu = chan->emu;
+
+	if (chan->lcr == SC16IS7XX_EMU_LCR_CONF_MODE_B) {
+		if (reg == SC16IS7XX_EMU_EFR_REG) {
+			chan->efr = val;
+			return;
+		}
+		if (reg >= SC16IS7XX_EMU_XON1_REG &&
+		    reg <= SC16IS7XX_EMU_XOFF2_REG) {
+			chan->xon_xoff[reg - SC16IS7XX_EMU_XON1_REG] = val;
+			return;
+		}
+	} else if (chan->lcr & SC16IS7XX_EMU_LCR_DLAB_BIT) {
+		if (reg == SC16IS7XX_EMU_DLL_REG) {
+			chan->dll = val;
+			sc16is7xx_emu_start_tx(chan);
+			return;
+		}
+		if (reg == SC16IS7XX_EMU_DLH_REG) {
+			chan->dlh = val;
+			sc16is7xx_emu_start_tx(chan);
+			return;
+		}
+	}
+
+	switch (reg) {
+	case SC16IS7XX_EMU_RHR_THR_REG:
+		/* a character written to a full FIFO is lost */
+		kfifo_put(&chan->tx_fifo, val);
+		chan->thri = false;
+		sc16is7xx_emu_start_tx(chan);
+		break;
+	case SC16IS7XX_EMU_IER_REG:
+		if (!sc16is7xx_emu_enhanced(chan))
+			val = (val & ~SC16IS7XX_EMU_IER_ENHANCED) |
+			      (chan->ier & SC16IS7XX_EMU_IER_ENHANCED);
+		/* enabling the THR interrupt raises it if there is room */
+		if (!(val & SC16IS7XX_EMU_IER_THRI_BIT))
+			chan->thri = false;
+		else if (!(chan->ier & SC16IS7XX_EMU_IER_THRI_BIT) &&
+			 sc16is7xx_emu_tx_space(chan) >=
+			 sc16is7xx_emu_tx_trigger(chan))
+			chan->thri = true;
+		chan->ier = val;
+		break;
+	case SC16IS7XX_EMU_IIR_FCR_REG:
+		if (!sc16is7xx_emu_enhanced(chan))
+			val = (val & ~SC16IS7XX_EMU_FCR_TXLVL_MASK) |
+			      (chan->fcr & SC16IS7XX_EMU_FCR_TXLVL_MASK);
+		if (val & SC16IS7XX_EMU_FCR_RXRESET_BIT) {
+			kfifo_reset(&chan->rx_fifo);
+			chan->rx_timeout = false;
+		}
+		if (val & SC16IS7XX_EMU_FCR_TXRESET_BIT) {
+			kfifo_reset(&chan->tx_fifo);
+			if (chan->ier & SC16IS7XX_EMU_IER_THRI_BIT)
+				chan->thri = true;
+		}
+		chan->fcr = val & ~(SC16IS7XX_EMU_FCR_RXRESET_BIT |
+				    SC16IS7XX_EMU_FCR_TXRESET_BIT);
+		break;
+	case SC16IS7XX_EMU_LCR_REG:
+		chan->lcr = val;
+		break;
+	case SC16IS7XX_EMU_MCR_REG:
+		if (!sc16is7xx_emu_enhanced(chan))
+			val = (val & ~SC16IS7XX_EMU_MCR_ENHANCED) |
+			      (chan->mcr & SC16IS7XX_EMU_MCR_ENHANCED);
+		chan->mcr = val;
+		break;
+	case SC16IS7XX_EMU_MSR_TCR_REG:
+		if (sc16is7xx_emu_tcrtlr(chan))
+			chan->tcr = val;
+		break;
+	case SC16IS7XX_EMU_SPR_TLR_REG:
+		if (sc16is7xx_emu_tcrtlr(chan))
+			chan->tlr = val;
+		else
+			chan->spr = val;
+		break;
+	case SC16IS7XX_EMU_IODIR_REG:
+		emu->iodir = val;
+		break;
+	case SC16IS7XX_EMU_IOSTATE_REG:
+		emu->iostate = val;
+		break;
+	case SC16IS7XX_EMU_IOINTENA_REG:
+		emu->iointena = val;
+		break;
+	case SC16IS7XX_EMU_IOCONTROL_REG:
+		if (val & SC16IS7XX_EMU_IOCONTROL_SRESET_BIT)
+			sc16is7xx_emu_reset(emu);
+		else
+			emu->iocontrol = val;
+		break;
+	case SC16IS7XX_EMU_EFCR_REG:
+		chan->efcr = val;
+		sc16is7xx_emu_start_tx(chan);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Pace a transfer like the bus would, nine clocks per byte including the
+ * address bytes, leaving out the start and stop conditions
+ */
+static void sc16is7xx_emu_bus_delay(struct i2c_msg *msgs, int num)
+{
+	unsigned int bytes = 0;
+	unsigned long us;
+	int i;
+
+	if (!bus_speed)
+		return;
+
+	for (i = 0; i < num; i++)
+		bytes += msgs[i].len + 1;
+	us = DIV_ROUND_UP_ULL((u64)bytes * 9 * USEC_PER_SEC, bus_speed);
+	usleep_range(us, us + us / 4);
+}
+
+/*
+ * A transfer starts with a write of the register address, bits 6:3 the
+ * register and bits 2:1 the channel, followed by the values to write or by
+ * a read. The address does not auto-increment, so multi-byte accesses
+ * all go to the same register, which is how the FIFOs are accessed.
+ */
+static int sc16is7xx_emu_xfer(struct i2c_adapter *adapter,
+			      struct i2c_msg *msgs, int num)
+{
+	struct sc16is7xx_emu *emu = i2c_get_adapdata(adapter);
+	struct sc16is7xx_emu_channel *chan = NULL;
+	unsigned long flags;
+	unsigned int ch;
+	u8 reg = 0;
+	int i, j;
+
+	for (i = 0; i < num; i++) {
+		if (msgs[i].addr != SC16IS7XX_EMU_ADDR)
+			return -ENXIO;
+		if (!(msgs[i].flags & I2C_M_RD) && msgs[i].len) {
+			ch = (msgs[i].buf[0] >> 1) & 0x03;
+			if (ch >= SC16IS7XX_EMU_NR_UART)
+				return -EIO;
+		}
+	}
+
+	sc16is7xx_emu_bus_delay(msgs, num);
+
+	spin_lock_irqsave(&emu->lock, flags);
+	for (i = 0; i < num; i++) {
+		if (msgs[i].flags & I2C_M_RD) {
+			if (!chan)
+				break;
+			for (j = 0; j < msgs[i].len; j++)
+				msgs[i].buf[j] = sc16is7xx_emu_read(chan, reg);
+		} else if (msgs[i].len) {
+			reg = (msgs[i].buf[0] >> 3) & 0x0f;
+			chan = &emu->chan[(msgs[i].buf[0] >> 1) & 0x03];
+			for (j = 1; j < msgs[i].len; j++)
+				sc16is7xx_emu_write(chan, reg, msgs[i].buf[j]);
+		}
+		sc16is7xx_emu_update_irq(emu);
+	}
+	spin_unlock_irqrestore(&emu->lock, flags);
+
+	/* a read without a register address is not acknowledged */
+	return i < num ? -EIO : num;
+}
+
+static u32 sc16is7xx_emu_func(struct i2c_adapter *adapter)
+{
+	return I2C_FUNC_I2C;
+}
+
+static const struct i2c_algorithm sc16is7xx_emu_algorithm = {
+	.master_xfer = sc16is7xx_emu_xfer,
+	.functionality = sc16is7xx_emu_func,
+};
+
+static void sc16is7xx_emu_irq_work(struct irq_work *work)
+{
+	struct sc16is7xx_emu *emu =
+		container_of(work, struct sc16is7xx_emu, irq_work);
+
+	generic_handle_irq(emu->irq);
+}
+
+static void sc16is7xx_emu_irq_noop(struct irq_data *data)
+{
+}
+
+/* An edge arriving while the interrupt is disabled is raised again */
+static int sc16is7xx_emu_irq_retrigger(struct irq_data *data)
+{
+	struct sc16is7xx_emu *emu = irq_data_get_irq_chip_data(data);
+
+	irq_work_queue(&emu->irq_work);
+
+	return 1;
+}
+
+static struct irq_chip sc16is7xx_emu_irq_chip = {
+	.name = "sc16is7xx-emu",
+	.irq_mask = sc16is7xx_emu_irq_noop,
+	.irq_unmask = sc16is7xx_emu_irq_noop,
+	.irq_retrigger = sc16is7xx_emu_irq_retrigger,
+};
+
+static int __init sc16is7xx_emu_init(void)
+{
+	struct i2c_board_info info = {
+		I2C_BOARD_INFO("sc16is762", SC16IS7XX_EMU_ADDR),
+	};
+	struct sc16is7xx_emu *emu;
+	struct sc16is7xx_emu_channel *chan;
+	int i, ret;
+
+	if (!clock)
+		return -EINVAL;
+
+	emu = kzalloc(sizeof(*emu), GFP_KERNEL);
+	if (!emu)
+		return -ENOMEM;
+
+	spin_lock_init(&emu->lock);
+	init_irq_work(&emu->irq_work, sc16is7xx_emu_irq_work);
+	emu->clock = clock;
+	for (i = 0; i < SC16IS7XX_EMU_NR_UART; i++) {
+		chan = &emu->chan[i];
+		chan->emu = emu;
+		INIT_KFIFO(chan->tx_fifo);
+		INIT_KFIFO(chan->rx_fifo);
+		hrtimer_init(&chan->tx_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		chan->tx_timer.function = sc16is7xx_emu_tx_timer;
+		hrtimer_init(&chan->rx_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		chan->rx_timer.function = sc16is7xx_emu_rx_timer;
+	}
+	sc16is7xx_emu_reset(emu);
+
+	emu->irq = irq_alloc_descs(-1, 1, 1, NUMA_NO_NODE);
+	if (emu->irq < 0) {
+		ret = emu->irq;
+		goto out_free;
+	}
+	irq_set_chip_and_handler(emu->irq, &sc16is7xx_emu_irq_chip,
+				 handle_simple_irq);
+	irq_set_chip_data(emu->irq, emu);
+	irq_modify_status(emu->irq, IRQ_NOREQUEST | IRQ_NOAUTOEN, IRQ_NOPROBE);
+
+	emu->adapter.owner = THIS_MODULE;
+	emu->adapter.algo = &sc16is7xx_emu_algorithm;
+	strlcpy(emu->adapter.name, "SC16IS762 emulator",
+		sizeof(emu->adapter.name));
+	i2c_set_adapdata(&emu->adapter, emu);
+	ret = i2c_add_adapter(&emu->adapter);
+	if (ret)
+		goto out_irq;
+
+	/* without a clock, sc16is7xx takes the frequency from platform data */
+	info.irq = emu->irq;
+	info.platform_data = &emu->clock;
+	emu->client = i2c_new_device(&emu->adapter, &info);
+	if (!emu->client) {
+		ret = -ENODEV;
+		goto out_adapter;
+	}
+
+	sc16is7xx_emu = emu;
+
+	return 0;
+
+out_adapter:
+	i2c_del_adapter(&emu->adapter);
+out_irq:
+	irq_free_descs(emu->irq, 1);
+out_free:
+	kfree(emu);
+
+	return ret;
+}
+
+static void __exit sc16is7xx_emu_exit(void)
+{
+	struct sc16is7xx_emu *emu = sc16is7xx_emu;
+	int i;
+
+	i2c_unregister_device(emu->client);
+	i2c_del_adapter(&emu->adapter);
+	for (i = 0; i < SC16IS7XX_EMU_NR_UART; i++) {
+		hrtimer_cancel(&emu->chan[i].tx_timer);
+		hrtimer_cancel(&emu->chan[i].rx_timer);
+	}
+	irq_work_sync(&emu->irq_work);
+	irq_free_descs(emu->irq, 1);
+	kfree(emu);
+}
+
+module_init(sc16is7xx_emu_init);
+module_exit(sc16is7xx_emu_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Emulated SC16IS762 for benchmarking the sc16is7xx driver");
@@ -0,0 +1,130 @@
+#!/bin/sh
+#
+# Measure how fast the IIO devices fed by the AVRs deliver samples while
+# they all run at once. Every sample costs at least one AVR command round
+# trip through the SC16IS762 UARTs on i2c2, so running the same devices on
+# two kernels compares their UART throughput.
+#
+# Each device gets its own sysfs trigger, fired as fast as the shell can.
+# A trigger arriving while the device is still busy with the previous one
+# is dropped, so the rate is bounded by the round trips and not by the
+# trigger. Run this on the robot. sc16is7xx-emu-bench.sh measures the
+# sc16is7xx driver alone, on an emulated SC16IS762.
+#
+# With the builderbot device tree, dds-sens and accel-sens sit on the
+# second channel of the SC16IS762 at 0x48 and las-sens and rf-sens on the
+# first channel of the one at 0x49.
+#
+
+IIO=/sys/bus/iio/devices
+BUFFER_LENGTH=4096
+
+if [ $# -lt 2 ]; then
+	echo "Usage: ${0} <seconds> <iio device name>..."
+	echo "Example: ${0} 10 dds-sens las-sens"
+	exit 1
+fi
+
+DURATION=${1}
+shift
+
+if [ ! -d ${IIO}/iio_sysfs_trigger ]; then
+	echo "IIO sysfs trigger support not found"
+	exit 1
+fi
+
+find_by_name() {
+	for dir in ${IIO}/${1}*; do
+		if [ "$(cat ${dir}/name 2>/dev/null)" = "${2}" ]; then
+			echo ${dir}
+			return 0
+		fi
+	done
+	return 1
+}
+
+# Bytes per scan with all channels enabled, each aligned to its own size
+scan_size() {
+	for type in ${1}/scan_elements/*_type; do
+		index=$(cat ${type%_type}_index)
+		bits=$(sed 's/.*\/\([0-9]*\).*/\1/' ${type})
+		echo "${index} $((bits / 8))"
+	done | sort -n | awk '
+		{
+			if (size % $2)
+				size += $2 - size % $2
+			size += $2
+			if ($2 > max)
+				max = $2
+		}
+		END {
+			if (size % max)
+				size += max - size % max
+			print size
+		}'
+}
+
+stop() {
+	for pid in ${PIDS}; do
+		kill ${pid} 2>/dev/null
+	done
+	for dev in ${DEVS}; do
+		echo 0 > ${dev}/buffer/enable
+		echo "" > ${dev}/trigger/current_trigger
+	done
+}
+
+trap 'stop; exit 1' INT TERM
+
+PIDS=""
+DEVS=""
+n=0
+for name in "$@"; do
+	dev=$(find_by_name iio:device ${name})
+	if [ -z "${dev}" ]; then
+		echo "IIO device not found: ${name}"
+		stop
+		exit 1
+	fi
+
+	trigger=$(find_by_name trigger sysfstrig${n})
+	if [ -z "${trigger}" ]; then
+		echo ${n} > ${IIO}/iio_sysfs_trigger/add_trigger
+		trigger=$(find_by_name trigger sysfstrig${n})
+	fi
+
+	echo 0 > ${dev}/buffer/enable
+	for en in ${dev}/scan_elements/*_en; do
+		echo 1 > ${en}
+	done
+	echo ${BUFFER_LENGTH} > ${dev}/buffer/length
+	echo sysfstrig${n} > ${dev}/trigger/current_trigger
+	echo 1 > ${dev}/buffer/enable
+	DEVS="${DEVS} ${dev}"
+
+	cat /dev/$(basename ${dev}) > /tmp/avr-uart-bench.${n} &
+	PIDS="${PIDS} $!"
+	(while true; do echo 1 > ${trigger}/trigger_now; done) 2>/dev/null &
+	PIDS="${PIDS} $!"
+
+	n=$((n + 1))
+done
+
+sleep ${DURATION}
+
+# Disable the buffers first so that the readers can drain them
+for dev in ${DEVS}; do
+	echo 0 > ${dev}/buffer/enable
+done
+sleep 1
+stop
+
+n=0
+for dev in ${DEVS}; do
+	bytes=$(wc -c < /tmp/avr-uart-bench.${n} 2>/dev/null || echo 0)
+	samples=$((bytes / $(scan_size ${dev})))
+	echo "$(cat ${dev}/name): ${samples} samples in ${DURATION} s," \
+	     "$((samples / DURATION)) samples/s"
+	rm -f /tmp/avr-uart-bench.${n}
+	n=$((n + 1))
+done
@@ -0,0 +1,121 @@
+#!/bin/sh
+#
+# Measure the round trips per second through both channels of an emulated
+# SC16IS762 while they run at once. The sc16is7xx-emu module instantiates
+# the sc16is7xx driver on an emulated chip on its own I2C adapter. The TX
+# of each channel is wired back to its RX, the characters are paced at the
+# baud rate and the transfers at the speed of i2c2. Each round trip writes a
+# frame to a port and reads it back, like an AVR command and its reply.
+#
+# The AVRs and the rest of i2c2 are not involved, so running this on two
+# kernels compares the sc16is7xx driver alone. The emulated chip has no
+# device tree node, so the driver runs with its default RX trigger level
+# rather than the nxp,rx-trigger-level of the builderbot device tree.
+#
+
+MODULE=sc16is7xx-emu
+ADAPTER="SC16IS762 emulator"
+STATS=/sys/kernel/debug/i2c-stats
+
+if [ $# -lt 1 ]; then
+	echo "Usage: ${0} <seconds> [frame length] [baud rate]"
+	echo "Example: ${0} 10 8 57600"
+	exit 1
+fi
+
+DURATION=${1}
+LENGTH=${2:-8}
+BAUD=${3:-57600}
+FRAME=$(printf "%${LENGTH}s" "" | tr ' ' 'U')
+
+if ! modprobe ${MODULE}; then
+	echo "${MODULE} module not found"
+	exit 1
+fi
+
+find_bus() {
+	for adapter in /sys/bus/i2c/devices/i2c-*; do
+		if [ "$(cat ${adapter}/name 2>/dev/null)" = "${ADAPTER}" ]; then
+			echo ${adapter#*i2c-}
+			return 0
+		fi
+	done
+	return 1
+}
+
+# Write a frame and read it back until terminated
+ping() {
+	count=0
+	lost=0
+	trap 'echo "${count} ${lost}" > /tmp/${MODULE}-bench.${2}; exit 0' TERM
+	exec 3<>${1}
+	while true; do
+		printf '%s' "${FRAME}" >&3
+		if read -r -n ${LENGTH} -t 1 -u 3 reply &&
+		   [ "${reply}" = "${FRAME}" ]; then
+			count=$((count + 1))
+		else
+			lost=$((lost + 1))
+			# drop what is left of the frame
+			while read -r -n 1 -t 1 -u 3 reply; do :; done
+		fi
+	done
+}
+
+stop() {
+	for pid in ${PIDS}; do
+		kill ${pid} 2>/dev/null
+	done
+	wait
+	modprobe -r ${MODULE}
+}
+
+trap 'stop; exit 1' INT
+
+BUS=$(find_bus)
+if [ -z "${BUS}" ]; then
+	echo "${ADAPTER} not found"
+	modprobe -r ${MODULE}
+	exit 1
+fi
+
+PORTS=$(ls /sys/bus/i2c/devices/${BUS}-0048/tty 2>/dev/null)
+if [ -z "${PORTS}" ]; then
+	echo "sc16is7xx did not probe on the ${ADAPTER}"
+	modprobe -r ${MODULE}
+	exit 1
+fi
+
+for port in ${PORTS}; do
+	stty -F /dev/${port} ${BAUD} raw -echo -crtscts -ixon -ixoff
+done
+
+[ -w ${STATS} ] && echo > ${STATS}
+
+PIDS=""
+for port in ${PORTS}; do
+	ping /dev/${port} ${port} &
+	PIDS="${PIDS} $!"
+done
+
+sleep ${DURATION}
+
+for pid in ${PIDS}; do
+	kill ${pid}
+done
+wait
+
+for port in ${PORTS}; do
+	read count lost < /tmp/${MODULE}-bench.${port}
+	echo "${port}: ${count} round trips of ${LENGTH} bytes at ${BAUD} baud" \
+	     "in ${DURATION} s, $((count / DURATION)) round trips/s," \
+	     "${lost} lost"
+	rm -f /tmp/${MODULE}-bench.${port}
+done
+
+# Bus usage of the emulated adapter, the adapter line and its clients
+if [ -r ${STATS} ]; then
+	sed -n "1p; /^i2c-${BUS} /,/^i2c-/{/^i2c-${BUS} /p; /^  /p}" ${STATS}
+fi
+
+modprobe -r ${MODULE}